@@ -7,6 +7,11 @@
 */
 
 #include "blur.h"
+#include "computekawaseblurengine.h"
+#include "gaussianblurengine.h"
+#include "kawaseblurengine.h"
+#include "mipmapblurengine.h"
+#include "programbinarycache.h"
 // KConfigSkeleton
 #include "blurconfig.h"
 
@@ -28,6 +33,11 @@
 #include "scene/windowitem.h"
 #endif
 
+#include <QAction>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFileInfo>
 #include <QGuiApplication>
 #include <QImage>
 #include <QMatrix4x4>
@@ -35,10 +45,13 @@
 #include <QTime>
 #include <QTimer>
 #include <QWindow>
+#include <algorithm>
 #include <cmath> // for ceil()
 #include <cstdlib>
+#include <unordered_set>
 
 #include <KConfigGroup>
+#include <KGlobalAccel>
 #include <KSharedConfig>
 
 #ifdef KDECORATION3
@@ -60,70 +73,181 @@ static void ensureResources()
 namespace KWin
 {
 
+/**
+ * Render targets of windows that weren't painted for this long are freed when the memory budget is exceeded. Measured
+ * in time rather than frames, since every output paints its own frames.
+ */
+static constexpr std::chrono::milliseconds s_idleTime = std::chrono::seconds(5);
+
+/**
+ * How long a screen has to be covered by a full screen window before its textures are freed.
+ */
+static constexpr std::chrono::milliseconds s_fullScreenPauseDelay = std::chrono::seconds(10);
+
+static qint64 textureBytes(GLenum format, const QSize &size, bool mipmaps)
+{
+    qint64 bytesPerPixel;
+    switch (format) {
+    case GL_RGBA16F:
+    case GL_RGBA16:
+        bytesPerPixel = 8;
+        break;
+    case GL_RGBA32F:
+        bytesPerPixel = 16;
+        break;
+    case GL_RGB565:
+        bytesPerPixel = 2;
+        break;
+    default:
+        bytesPerPixel = 4;
+        break;
+    }
+
+    qint64 bytes = qint64(size.width()) * size.height() * bytesPerPixel;
+    // All mipmap levels together add a third of the size of the base level.
+    if (mipmaps) {
+        bytes += bytes / 3;
+    }
+    return bytes;
+}
+
+static qint64 textureBytes(const GLTexture *texture)
+{
+    if (!texture) {
+        return 0;
+    }
+    return textureBytes(texture->internalFormat(), texture->size(), texture->filter() == GL_LINEAR_MIPMAP_LINEAR);
+}
+
+/**
+ * Adds two triangles covering the specified rect to the vertex buffer. Texture coordinates are relative to a texture
+ * of the specified size positioned at (0, 0).
+ */
+static void addQuad(std::span<GLVertex2D> map, size_t &vboIndex, const QRectF &rect, const QSizeF &textureSize)
+{
+    const float x0 = rect.left();
+    const float y0 = rect.top();
+    const float x1 = rect.right();
+    const float y1 = rect.bottom();
+
+    const float u0 = x0 / textureSize.width();
+    const float v0 = 1.0f - y0 / textureSize.height();
+    const float u1 = x1 / textureSize.width();
+    const float v1 = 1.0f - y1 / textureSize.height();
+
+    // first triangle
+    map[vboIndex++] = GLVertex2D{
+        .position = QVector2D(x0, y0),
+        .texcoord = QVector2D(u0, v0),
+    };
+    map[vboIndex++] = GLVertex2D{
+        .position = QVector2D(x1, y1),
+        .texcoord = QVector2D(u1, v1),
+    };
+    map[vboIndex++] = GLVertex2D{
+        .position = QVector2D(x0, y1),
+        .texcoord = QVector2D(u0, v1),
+    };
+
+    // second triangle
+    map[vboIndex++] = GLVertex2D{
+        .position = QVector2D(x0, y0),
+        .texcoord = QVector2D(u0, v0),
+    };
+    map[vboIndex++] = GLVertex2D{
+        .position = QVector2D(x1, y0),
+        .texcoord = QVector2D(u1, v0),
+    };
+    map[vboIndex++] = GLVertex2D{
+        .position = QVector2D(x1, y1),
+        .texcoord = QVector2D(u1, v1),
+    };
+}
+
+/**
+ * @return The region with every rectangle grown by the specified size in all directions.
+ */
+static QRegion expandedRegion(const QRegion &region, int size)
+{
+    QRegion expanded;
+    for (const QRect &rect : region) {
+        expanded += rect.adjusted(-size, -size, size, size);
+    }
+    return expanded;
+}
+
+/**
+ * @param shape The shape in global logical coordinates.
+ * @param region The region that is painted, in global logical coordinates.
+ * @return The part of the shape that is painted, in device pixels relative to the background.
+ */
+static QList<QRectF> effectiveShape(const QRegion &shape, const QRegion &region, const RenderViewport &viewport, const QRect &backgroundRect, const QRect &deviceBackgroundRect)
+{
+    QList<QRectF> effectiveShape;
+    effectiveShape.reserve(shape.rectCount());
+    if (region != infiniteRegion()) {
+        for (const QRect &clipRect : region) {
+            const QRectF deviceClipRect = snapToPixelGridF(scaledRect(clipRect, viewport.scale()))
+                    .translated(-deviceBackgroundRect.topLeft());
+            for (const QRect &shapeRect : shape) {
+                const QRectF deviceShapeRect = snapToPixelGridF(scaledRect(shapeRect.translated(-backgroundRect.topLeft()), viewport.scale()));
+                if (const QRectF intersected = deviceClipRect.intersected(deviceShapeRect); !intersected.isEmpty()) {
+                    effectiveShape.append(intersected);
+                }
+            }
+        }
+    } else {
+        for (const QRect &rect : shape) {
+            effectiveShape.append(snapToPixelGridF(scaledRect(rect.translated(-backgroundRect.topLeft()), viewport.scale())));
+        }
+    }
+    return effectiveShape;
+}
+
 static const QByteArray s_blurAtomName = QByteArrayLiteral("_KDE_NET_WM_BLUR_BEHIND_REGION");
 
+// The maximum length of the blur region property in 32-bit units, 4 for each rect.
+static constexpr uint32_t s_maxBlurRegionLength = 4 * 16384;
+
+/**
+ * @return The blur region stored in the property, or std::nullopt if the window doesn't have the property.
+ */
+static std::optional<QRegion> parseBlurRegion(const xcb_get_property_reply_t *reply)
+{
+    if (!reply || reply->type != XCB_ATOM_CARDINAL || reply->format != 32) {
+        return std::nullopt;
+    }
+
+    QRegion region;
+    const int length = xcb_get_property_value_length(reply);
+    if (length > 0 && !(length % (4 * sizeof(uint32_t)))) {
+        const uint32_t *cardinals = reinterpret_cast<const uint32_t *>(xcb_get_property_value(reply));
+        for (unsigned int i = 0; i < length / sizeof(uint32_t);) {
+            int x = cardinals[i++];
+            int y = cardinals[i++];
+            int w = cardinals[i++];
+            int h = cardinals[i++];
+            region += Xcb::fromXNative(QRect(x, y, w, h)).toRect();
+        }
+    }
+    return region;
+}
+
 BlurManagerInterface *BlurEffect::s_blurManager = nullptr;
 QTimer *BlurEffect::s_blurManagerRemoveTimer = nullptr;
 
 BlurEffect::BlurEffect()
+    : m_statistics([this]() {
+        return statisticsGauges();
+    })
 {
     BlurConfig::instance(effects->config());
     ensureResources();
 
-    m_downsamplePass.shader = ShaderManager::instance()->generateShaderFromFile(ShaderTrait::MapTexture,
-                                                                                QStringLiteral(":/effects/forceblur/shaders/vertex.vert"),
-                                                                                QStringLiteral(":/effects/forceblur/shaders/downsample.frag"));
-    if (!m_downsamplePass.shader) {
-        qCWarning(KWIN_BLUR) << "Failed to load downsampling pass shader";
-        return;
-    } else {
-        m_downsamplePass.mvpMatrixLocation = m_downsamplePass.shader->uniformLocation("modelViewProjectionMatrix");
-        m_downsamplePass.offsetLocation = m_downsamplePass.shader->uniformLocation("offset");
-        m_downsamplePass.halfpixelLocation = m_downsamplePass.shader->uniformLocation("halfpixel");
-        m_downsamplePass.transformColorsLocation = m_downsamplePass.shader->uniformLocation("transformColors");
-        m_downsamplePass.colorMatrixLocation = m_downsamplePass.shader->uniformLocation("colorMatrix");
-    }
-
-    m_upsamplePass.shader = ShaderManager::instance()->generateShaderFromFile(ShaderTrait::MapTexture,
-                                                                              QStringLiteral(":/effects/forceblur/shaders/vertex.vert"),
-                                                                              QStringLiteral(":/effects/forceblur/shaders/upsample.frag"));
-    if (!m_upsamplePass.shader) {
-        qCWarning(KWIN_BLUR) << "Failed to load upsampling pass shader";
-        return;
-    } else {
-        m_upsamplePass.mvpMatrixLocation = m_upsamplePass.shader->uniformLocation("modelViewProjectionMatrix");
-        m_upsamplePass.offsetLocation = m_upsamplePass.shader->uniformLocation("offset");
-        m_upsamplePass.halfpixelLocation = m_upsamplePass.shader->uniformLocation("halfpixel");
-        m_upsamplePass.textureLocation = m_upsamplePass.shader->uniformLocation("texUnit");
-        m_upsamplePass.noiseLocation = m_upsamplePass.shader->uniformLocation("noise");
-        m_upsamplePass.noiseTextureLocation = m_upsamplePass.shader->uniformLocation("noiseTexture");
-        m_upsamplePass.noiseTextureSizeLocation = m_upsamplePass.shader->uniformLocation("noiseTextureSize");
-        m_upsamplePass.topCornerRadiusLocation = m_upsamplePass.shader->uniformLocation("topCornerRadius");
-        m_upsamplePass.bottomCornerRadiusLocation = m_upsamplePass.shader->uniformLocation("bottomCornerRadius");
-        m_upsamplePass.antialiasingLocation = m_upsamplePass.shader->uniformLocation("antialiasing");
-        m_upsamplePass.blurSizeLocation = m_upsamplePass.shader->uniformLocation("blurSize");
-        m_upsamplePass.opacityLocation = m_upsamplePass.shader->uniformLocation("opacity");
-    }
-
-    m_texture.shader = ShaderManager::instance()->generateShaderFromFile(ShaderTrait::MapTexture,
-                                                                         QStringLiteral(":/effects/forceblur/shaders/vertex.vert"),
-                                                                         QStringLiteral(":/effects/forceblur/shaders/texture.frag"));
-    if (!m_texture.shader) {
-        qCWarning(KWIN_BLUR) << "Failed to load texture pass shader";
-        return;
-    } else {
-        m_texture.mvpMatrixLocation = m_texture.shader->uniformLocation("modelViewProjectionMatrix");
-        m_texture.textureSizeLocation = m_texture.shader->uniformLocation("textureSize");
-        m_texture.texStartPosLocation = m_texture.shader->uniformLocation("texStartPos");
-        m_texture.blurSizeLocation = m_texture.shader->uniformLocation("blurSize");
-        m_texture.scaleLocation = m_texture.shader->uniformLocation("scale");
-        m_texture.topCornerRadiusLocation = m_texture.shader->uniformLocation("topCornerRadius");
-        m_texture.bottomCornerRadiusLocation = m_texture.shader->uniformLocation("bottomCornerRadius");
-        m_texture.antialiasingLocation = m_texture.shader->uniformLocation("antialiasing");
-        m_texture.opacityLocation = m_texture.shader->uniformLocation("opacity");
-    }
-
-    initBlurStrengthValues();
+    connect(&m_imageLoader, &StaticBlurImageLoader::imageReady, this, [this]() {
+        repaintBlurArea();
+    });
+
     reconfigure(ReconfigureAll);
 
     if (effects->xcbConnection()) {
@@ -152,10 +276,34 @@ BlurEffect::BlurEffect()
     connect(effects, &EffectsHandler::propertyNotify, this, &BlurEffect::slotPropertyNotify);
     connect(effects, &EffectsHandler::xcbConnectionChanged, this, [this]() {
         net_wm_blur_region = effects->announceSupportProperty(s_blurAtomName, this);
+        m_records.forEach([](EffectWindow *, WindowRecord &record) {
+            record.x11BlurRegionFetched = false;
+        });
+    });
+    // No default shortcut, it can be assigned in the shortcut settings.
+    auto *toggleDebugOverlayAction = new QAction(this);
+    toggleDebugOverlayAction->setObjectName(QStringLiteral("ToggleBetterBlurDebugOverlay"));
+    toggleDebugOverlayAction->setText(QStringLiteral("Toggle Better Blur Debug Overlay"));
+    KGlobalAccel::self()->setDefaultShortcut(toggleDebugOverlayAction, {});
+    KGlobalAccel::self()->setShortcut(toggleDebugOverlayAction, {});
+    connect(toggleDebugOverlayAction, &QAction::triggered, this, &BlurEffect::toggleDebugOverlay);
+    if (qEnvironmentVariableIntValue("KWIN_BLUR_DEBUG_OVERLAY")) {
+        toggleDebugOverlay();
+    }
+
+    m_fullScreenPauseTimer.setSingleShot(true);
+    connect(&m_fullScreenPauseTimer, &QTimer::timeout, this, &BlurEffect::freePausedScreenTextures);
+
+    connect(effects, &EffectsHandler::screenLockingChanged, this, [this](bool locked) {
+        // Nothing is blurred while the screen is locked, see isActive().
+        if (locked && effects->makeOpenGLContextCurrent()) {
+            freeAllTextures();
+        }
     });
 
     // Fetch the blur regions for all windows
     const auto stackingOrder = effects->stackingOrder();
+    fetchX11BlurRegions(stackingOrder);
     for (EffectWindow *window : stackingOrder) {
         slotWindowAdded(window);
     }
@@ -168,86 +316,236 @@ BlurEffect::BlurEffect()
 
 BlurEffect::~BlurEffect()
 {
+    glDeleteProgram(m_texture.program);
+
     // When compositing is restarted, avoid removing the manager immediately.
     if (s_blurManager) {
         s_blurManagerRemoveTimer->start(1000);
     }
 }
 
-void BlurEffect::initBlurStrengthValues()
+void BlurEffect::reconfigure(ReconfigureFlags flags)
 {
-    // This function creates an array of blur strength values that are evenly distributed
+    const ForceBlurSettings oldForceBlur = m_settings.forceBlur;
+    const int oldExpandSize = m_expandSize;
+    const QRegion oldBlurArea = blurArea();
+
+    const BlurSettingsChanges changes = m_settings.read();
+
+    // The custom image may have been replaced without any setting changing, so this is checked on every reconfigure.
+    const QByteArray oldImageKey = m_imageLoader.key();
+    m_imageLoader.setPath(m_settings.staticBlur.enable && m_settings.staticBlur.imageSource == StaticBlurImageSource::Custom
+        ? m_settings.staticBlur.customImagePath
+        : QString());
+    if (m_imageLoader.key() != oldImageKey) {
+        effects->makeOpenGLContextCurrent();
+        m_staticBlurTextures.clear();
+        repaintBlurArea();
+    }
+
+    if (!changes && m_strength == m_settings.general.blurStrength) {
+        return;
+    }
 
-    // The range of the slider on the blur settings UI
-    int numOfBlurSteps = 15;
-    int remainingSteps = numOfBlurSteps;
+    bool strengthChanged = changes & BlurSettingsChange::Strength;
+    if (changes & BlurSettingsChange::Engine || !m_engine) {
+        effects->makeOpenGLContextCurrent();
+        m_engine = createEngine();
+        strengthChanged = true;
+    }
+    // The strength may also have been reduced because render targets couldn't be allocated.
+    if (strengthChanged || m_strength != m_settings.general.blurStrength) {
+        effects->makeOpenGLContextCurrent();
+        m_records.forEach([](EffectWindow *, WindowRecord &record) {
+            if (record.blur) {
+                record.blur->render.clear();
+            }
+        });
+        m_batchRender.clear();
+        m_secondaryRender = BlurRenderData();
+        m_strength = m_settings.general.blurStrength;
+        m_allocationFailing = false;
+        if (m_engine) {
+            m_engine->setStrength(m_strength);
+            m_expandSize = m_engine->expandSize();
+        }
+    }
+
+    if (changes & BlurSettingsChange::ColorMatrix) {
+        m_colorMatrix = colorMatrix(m_settings.general.brightness, m_settings.general.saturation, m_settings.general.contrast);
 
-    /*
-     * Explanation for these numbers:
-     *
-     * The texture blur amount depends on the downsampling iterations and the offset value.
-     * By changing the offset we can alter the blur amount without relying on further downsampling.
-     * But there is a minimum and maximum value of offset per downsample iteration before we
-     * get artifacts.
-     *
-     * The minOffset variable is the minimum offset value for an iteration before we
-     * get blocky artifacts because of the downsampling.
-     *
-     * The maxOffset value is the maximum offset value for an iteration before we
-     * get diagonal line artifacts because of the nature of the dual kawase blur algorithm.
-     *
-     * The expandSize value is the minimum value for an iteration before we reach the end
-     * of a texture in the shader and sample outside of the area that was copied into the
-     * texture from the screen.
-     */
+        // The render targets can be kept, but the blurred results can't be reused anymore.
+        m_records.forEach([](EffectWindow *, WindowRecord &record) {
+            if (record.blur) {
+                for (auto &[screen, renderInfo] : record.blur->render) {
+                    renderInfo.blurredArea = {};
+                }
+            }
+        });
+        for (auto &[screen, renderData] : m_batchRender) {
+            renderData.render.blurredArea = {};
+        }
+    }
+
+    // Static blur textures are blurred with the current engine, color matrix and noise.
+    if (changes & (BlurSettingsChange::StaticBlur | BlurSettingsChange::Engine | BlurSettingsChange::Strength | BlurSettingsChange::ColorMatrix | BlurSettingsChange::Noise)) {
+        m_staticBlurTextures.clear();
+        m_staticBlurCacheMisses.clear();
 
-    // {minOffset, maxOffset, expandSize}
-    blurOffsets.append({1.0, 2.0, 10}); // Down sample size / 2
-    blurOffsets.append({2.0, 3.0, 20}); // Down sample size / 4
-    blurOffsets.append({2.0, 5.0, 50}); // Down sample size / 8
-    blurOffsets.append({3.0, 8.0, 150}); // Down sample size / 16
-    // blurOffsets.append({5.0, 10.0, 400}); // Down sample size / 32
-    // blurOffsets.append({7.0, ?.0});       // Down sample size / 64
+        // The windows behind are only tracked while disableWhenWindowBehind is enabled, but read whenever static blur
+        // is. Drop what was tracked with the old settings, prePaintWindow fills it in again if needed.
+        if (changes & BlurSettingsChange::StaticBlur) {
+            m_records.forEach([](EffectWindow *, WindowRecord &record) {
+                if (record.blur) {
+                    record.blur->windowsBehind = {};
+                }
+            });
+        }
 
-    float offsetSum = 0;
+        // The CPU implementation only exists for the dual Kawase algorithm, custom images are blurred on the GPU when
+        // another engine is used.
+        const auto *kawaseEngine = dynamic_cast<const KawaseBlurEngine *>(m_engine.get());
+        m_imageLoader.setBlurParameters(m_settings.staticBlur.blurCustomImage && kawaseEngine
+            ? std::optional(CpuBlurParameters{kawaseEngine->iterationCount(), static_cast<float>(kawaseEngine->offset()), m_settings.general.noiseStrength})
+            : std::nullopt);
+    }
 
-    for (int i = 0; i < blurOffsets.size(); i++) {
-        offsetSum += blurOffsets[i].maxOffset - blurOffsets[i].minOffset;
+    if (changes & BlurSettingsChange::Engine && qEnvironmentVariableIntValue("KWIN_BLUR_COMPARE_KERNELS")) {
+        compareKernels();
     }
 
-    for (int i = 0; i < blurOffsets.size(); i++) {
-        int iterationNumber = std::ceil((blurOffsets[i].maxOffset - blurOffsets[i].minOffset) / offsetSum * numOfBlurSteps);
-        remainingSteps -= iterationNumber;
+    // Only windows that are force blurred with the old or new settings need their blur region updated. There are no
+    // old settings to compare with the first time.
+    if (changes & BlurSettingsChange::ForceBlur) {
+        const bool decorationsChanged = oldForceBlur.blurDecorations != m_settings.forceBlur.blurDecorations;
+        QList<EffectWindow *> affectedWindows;
+        for (EffectWindow *w : effects->stackingOrder()) {
+            if (changes == BlurSettingsChange::All) {
+                affectedWindows.append(w);
+                continue;
+            }
 
-        if (remainingSteps < 0) {
-            iterationNumber += remainingSteps;
+            const bool wasForced = shouldForceBlur(w, oldForceBlur);
+            const bool isForced = shouldForceBlur(w, m_settings.forceBlur);
+            if (wasForced != isForced || (decorationsChanged && isForced)) {
+                affectedWindows.append(w);
+            }
         }
+        fetchX11BlurRegions(affectedWindows);
+        for (EffectWindow *w : affectedWindows) {
+            updateBlurRegion(w);
+        }
+    }
 
-        float offsetDifference = blurOffsets[i].maxOffset - blurOffsets[i].minOffset;
+    // Repaint the areas that were and are blurred, including the background they sample.
+    effects->addRepaint(expandedRegion(oldBlurArea | blurArea(), std::max(oldExpandSize, m_expandSize)));
+}
 
-        for (int j = 1; j <= iterationNumber; j++) {
-            // {iteration, offset}
-            blurStrengthValues.append({i + 1, blurOffsets[i].minOffset + (offsetDifference / iterationNumber) * j});
+std::unique_ptr<BlurEngine> BlurEffect::createEngine() const
+{
+    std::unique_ptr<BlurEngine> engine;
+    switch (m_settings.general.algorithm) {
+    case BlurAlgorithm::Kawase:
+        // The compute shaders only implement the standard kernel.
+        if (m_settings.general.computeShaders && m_settings.general.kernel == KawaseKernel::Standard && ComputeKawaseBlurEngine::isSupported()) {
+            engine = std::make_unique<ComputeKawaseBlurEngine>();
+            if (engine->isValid()) {
+                break;
+            }
         }
+        engine = std::make_unique<KawaseBlurEngine>(m_settings.general.kernel);
+        break;
+    case BlurAlgorithm::Gaussian:
+        engine = std::make_unique<GaussianBlurEngine>();
+        break;
+    case BlurAlgorithm::Mipmap:
+        engine = std::make_unique<MipmapBlurEngine>();
+        break;
+    }
+    if (engine && engine->isValid()) {
+        return engine;
+    }
+
+    qCWarning(KWIN_BLUR) << "Failed to load the shaders of the selected blur algorithm, falling back to dual Kawase";
+    engine = std::make_unique<KawaseBlurEngine>(KawaseKernel::Standard);
+    if (!engine->isValid()) {
+        qCWarning(KWIN_BLUR) << "Failed to load the dual Kawase shaders";
+        return nullptr;
     }
+    return engine;
 }
 
-void BlurEffect::reconfigure(ReconfigureFlags flags)
+void BlurEffect::compareKernels()
 {
-    m_settings.read();
+    if (!effects->makeOpenGLContextCurrent()) {
+        return;
+    }
 
-    m_iterationCount = blurStrengthValues[m_settings.general.blurStrength].iteration;
-    m_offset = blurStrengthValues[m_settings.general.blurStrength].offset;
-    m_expandSize = blurOffsets[m_iterationCount - 1].expandSize;
-    m_staticBlurTextures.clear();
-    m_colorMatrix = colorMatrix(m_settings.general.brightness, m_settings.general.saturation, m_settings.general.contrast);
+    // Sharp edges and smooth gradients.
+    QImage pattern(512, 512, QImage::Format_RGBA8888_Premultiplied);
+    for (int y = 0; y < pattern.height(); y++) {
+        uchar *line = pattern.scanLine(y);
+        for (int x = 0; x < pattern.width(); x++) {
+            line[x * 4] = ((x / 32) + (y / 32)) % 2 ? 255 : 0;
+            line[x * 4 + 1] = x / 2;
+            line[x * 4 + 2] = y / 2;
+            line[x * 4 + 3] = 255;
+        }
+    }
 
-    for (EffectWindow *w : effects->stackingOrder()) {
-        updateBlurRegion(w);
+    constexpr int timedIterations = 10;
+    std::unique_ptr<BlurEngine> engine = std::move(m_engine);
+    QImage results[2];
+    qint64 times[2];
+    for (const KawaseKernel candidate : {KawaseKernel::Standard, KawaseKernel::FetchOptimized}) {
+        const int index = static_cast<int>(candidate);
+        m_engine = std::make_unique<KawaseBlurEngine>(candidate);
+
+        auto texture = GLTexture::upload(pattern);
+        if (!m_engine->isValid() || !texture) {
+            m_engine = std::move(engine);
+            return;
+        }
+        m_engine->setStrength(m_settings.general.blurStrength);
+        texture->setFilter(GL_LINEAR);
+        texture->setWrapMode(GL_CLAMP_TO_EDGE);
+
+        blur(texture.get());
+        results[index] = texture->toImage();
+
+        glFinish();
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < timedIterations; i++) {
+            blur(texture.get());
+        }
+        glFinish();
+        times[index] = timer.nsecsElapsed() / timedIterations;
+    }
+    m_engine = std::move(engine);
+
+    const QImage standard = results[0].convertToFormat(QImage::Format_RGBA8888);
+    const QImage fetchOptimized = results[1].convertToFormat(QImage::Format_RGBA8888);
+    int maxDifference = 0;
+    qint64 totalDifference = 0;
+    for (int y = 0; y < standard.height(); y++) {
+        const uchar *a = standard.constScanLine(y);
+        const uchar *b = fetchOptimized.constScanLine(y);
+        for (int x = 0; x < standard.width() * 4; x++) {
+            if (x % 4 == 3) {
+                continue;
+            }
+            const int difference = std::abs(a[x] - b[x]);
+            maxDifference = std::max(maxDifference, difference);
+            totalDifference += difference;
+        }
     }
 
-    // Update all windows for the blur to take effect
-    effects->addRepaintFull();
+    // Only shown with QT_LOGGING_RULES="kwin_better_blur.info=true", see the documentation.
+    qCInfo(KWIN_BLUR) << "Kernel comparison at blur strength" << m_settings.general.blurStrength + 1
+                      << "- standard:" << times[0] / 1000 << "us, fetch-optimized:" << times[1] / 1000 << "us,"
+                      << "max difference:" << maxDifference << "mean difference:"
+                      << static_cast<double>(totalDifference) / (standard.width() * standard.height() * 3);
 }
 
 void BlurEffect::updateBlurRegion(EffectWindow *w, bool geometryChanged)
@@ -255,21 +553,10 @@ void BlurEffect::updateBlurRegion(EffectWindow *w, bool geometryChanged)
     std::optional<QRegion> content;
     std::optional<QRegion> frame;
 
-    if (net_wm_blur_region != XCB_ATOM_NONE) {
-        const QByteArray value = w->readProperty(net_wm_blur_region, XCB_ATOM_CARDINAL, 32);
-        QRegion region;
-        if (value.size() > 0 && !(value.size() % (4 * sizeof(uint32_t)))) {
-            const uint32_t *cardinals = reinterpret_cast<const uint32_t *>(value.constData());
-            for (unsigned int i = 0; i < value.size() / sizeof(uint32_t);) {
-                int x = cardinals[i++];
-                int y = cardinals[i++];
-                int w = cardinals[i++];
-                int h = cardinals[i++];
-                region += Xcb::fromXNative(QRect(x, y, w, h)).toRect();
-            }
-        }
-        if (!value.isNull()) {
-            content = region;
+    if (net_wm_blur_region != XCB_ATOM_NONE && w->isX11Client()) {
+        fetchX11BlurRegions({w});
+        if (const WindowRecord *record = m_records.find(w)) {
+            content = record->x11BlurRegion;
         }
     }
 
@@ -305,16 +592,20 @@ void BlurEffect::updateBlurRegion(EffectWindow *w, bool geometryChanged)
     }
 
     if (content.has_value() || frame.has_value()) {
-        BlurEffectData &data = m_windows[w];
+        WindowRecord &record = m_records.insert(w);
+        if (!record.blur) {
+            record.blur.emplace();
+        }
+        BlurEffectData &data = *record.blur;
         data.content = content;
         data.frame = frame;
 #ifdef KWIN_6_2_OR_GREATER
         data.windowEffect = ItemEffect(w->windowItem());
 #endif
     } else if (!geometryChanged) { // Blur may disappear if this method is called when window geometry changes
-        if (auto it = m_windows.find(w); it != m_windows.end()) {
+        if (WindowRecord *record = m_records.find(w); record && record->blur) {
             effects->makeOpenGLContextCurrent();
-            m_windows.erase(it);
+            record->blur.reset();
         }
     }
 }
@@ -325,10 +616,9 @@ bool BlurEffect::hasStaticBlur(EffectWindow *w)
         return false;
     }
 
-    if (m_settings.staticBlur.disableWhenWindowBehind) {
-        if (auto it = m_windows.find(w); it != m_windows.end()) {
-            return !it->second.hasWindowBehind;
-        }
+    // Parts of the window that have other windows behind are blurred normally.
+    if (const BlurEffectData *blurInfo = blurData(w)) {
+        return blurInfo->windowsBehind != blurRegion(w).translated(w->pos().toPoint());
     }
 
     return true;
@@ -336,17 +626,21 @@ bool BlurEffect::hasStaticBlur(EffectWindow *w)
 
 void BlurEffect::slotWindowAdded(EffectWindow *w)
 {
+    WindowRecord &record = m_records.insert(w);
+    const auto handle = m_records.handle(w);
+
     SurfaceInterface *surf = w->surface();
 
     if (surf) {
-        windowBlurChangedConnections[w] = connect(surf, &SurfaceInterface::blurChanged, this, [this, w]() {
-            if (w) {
+        record.blurChangedConnection = connect(surf, &SurfaceInterface::blurChanged, this, [this, handle]() {
+            if (EffectWindow *w = m_records.window(handle)) {
                 updateBlurRegion(w);
             }
         });
     }
 
-    windowFrameGeometryChangedConnections[w] = connect(w, &EffectWindow::windowFrameGeometryChanged, this, [this,w]() {
+    record.frameGeometryChangedConnection = connect(w, &EffectWindow::windowFrameGeometryChanged, this, [this, handle]() {
+        EffectWindow *w = m_records.window(handle);
         if (!w) {
             return;
         }
@@ -367,30 +661,37 @@ void BlurEffect::slotWindowAdded(EffectWindow *w)
     setupDecorationConnections(w);
 
     updateBlurRegion(w);
-
-    m_allWindows.push_back(w);
 }
 
 void BlurEffect::slotWindowDeleted(EffectWindow *w)
 {
-    if (auto it = m_windows.find(w); it != m_windows.end()) {
-        effects->makeOpenGLContextCurrent();
-        m_windows.erase(it);
+    if (WindowRecord *record = m_records.find(w)) {
+        if (record->blur) {
+            effects->makeOpenGLContextCurrent();
+        }
+        disconnect(record->blurChangedConnection);
+        disconnect(record->frameGeometryChangedConnection);
+        m_records.remove(w);
     }
-    if (auto it = windowBlurChangedConnections.find(w); it != windowBlurChangedConnections.end()) {
-        disconnect(*it);
-        windowBlurChangedConnections.erase(it);
+
+    m_predictedOpaque.erase(w);
+    m_occludedBlur.erase(w);
+    if (m_debugOverlay) {
+        m_debugOverlay->windowDeleted(w);
     }
-    if (auto it = windowFrameGeometryChangedConnections.find(w); it != windowFrameGeometryChangedConnections.end()) {
-        disconnect(*it);
-        windowFrameGeometryChangedConnections.erase(it);
+
+    for (auto &[screen, frame] : m_screenFrames) {
+        frame.paintedWindows.removeIf([w](const PaintedWindow &painted) {
+            return painted.window == w;
+        });
     }
-    if (auto it = std::find(m_allWindows.begin(), m_allWindows.end(), w); it != m_allWindows.end()) {
-        m_allWindows.erase(it);
+    if (m_batch && m_batch->windows.contains(w)) {
+        m_batch.reset();
     }
-
-    if (m_blurWhenTransformed.contains(w)) {
-        m_blurWhenTransformed.removeOne(w);
+    for (auto &[screen, renderData] : m_batchRender) {
+        if (renderData.batch && renderData.batch->windows.contains(w)) {
+            renderData.batch.reset();
+        }
     }
 }
 
@@ -402,17 +703,20 @@ void BlurEffect::slotScreenAdded(KWin::Output *screen)
         }
 
         m_staticBlurTextures.erase(screen);
-        effects->addRepaintFull();
+        repaintBlurArea(screen);
     });
 }
 
 void BlurEffect::slotScreenRemoved(KWin::Output *screen)
 {
-    for (auto &[window, data] : m_windows) {
-        if (auto it = data.render.find(screen); it != data.render.end()) {
-            effects->makeOpenGLContextCurrent();
-            data.render.erase(it);
+    freeScreenTextures(screen);
+    m_fullScreenPauses.erase(screen);
+
+    if (auto it = m_screenFrames.find(screen); it != m_screenFrames.end()) {
+        if (m_frame == &it->second) {
+            m_frame = nullptr;
         }
+        m_screenFrames.erase(it);
     }
 
     if (auto it = screenChangedConnections.find(screen); it != screenChangedConnections.end()) {
@@ -424,10 +728,38 @@ void BlurEffect::slotScreenRemoved(KWin::Output *screen)
 void BlurEffect::slotPropertyNotify(EffectWindow *w, long atom)
 {
     if (w && atom == net_wm_blur_region && net_wm_blur_region != XCB_ATOM_NONE) {
+        if (WindowRecord *record = m_records.find(w)) {
+            record->x11BlurRegionFetched = false;
+        }
         updateBlurRegion(w);
     }
 }
 
+void BlurEffect::fetchX11BlurRegions(const QList<EffectWindow *> &windows)
+{
+    xcb_connection_t *connection = effects->xcbConnection();
+    if (!connection || net_wm_blur_region == XCB_ATOM_NONE) {
+        return;
+    }
+
+    std::vector<std::pair<EffectWindow *, xcb_get_property_cookie_t>> requests;
+    for (EffectWindow *w : windows) {
+        if (!w->isX11Client() || m_records.insert(w).x11BlurRegionFetched) {
+            continue;
+        }
+        requests.emplace_back(w, xcb_get_property_unchecked(connection, false, w->windowId(), net_wm_blur_region, XCB_ATOM_CARDINAL, 0, s_maxBlurRegionLength));
+    }
+
+    for (const auto &[w, cookie] : requests) {
+        xcb_get_property_reply_t *reply = xcb_get_property_reply(connection, cookie, nullptr);
+        if (WindowRecord *record = m_records.find(w)) {
+            record->x11BlurRegion = parseBlurRegion(reply);
+            record->x11BlurRegionFetched = true;
+        }
+        free(reply);
+    }
+}
+
 void BlurEffect::setupDecorationConnections(EffectWindow *w)
 {
     if (!w->decoration()) {
@@ -498,9 +830,9 @@ QRegion BlurEffect::blurRegion(EffectWindow *w) const
 {
     QRegion region;
 
-    if (auto it = m_windows.find(w); it != m_windows.end()) {
-        const std::optional<QRegion> &content = it->second.content;
-        const std::optional<QRegion> &frame = it->second.frame;
+    if (const BlurEffectData *blurInfo = blurData(w)) {
+        const std::optional<QRegion> &content = blurInfo->content;
+        const std::optional<QRegion> &frame = blurInfo->frame;
         if (content.has_value()) {
             if (content->isEmpty()) {
                 // An empty region means that the blur effect should be enabled
@@ -520,26 +852,243 @@ QRegion BlurEffect::blurRegion(EffectWindow *w) const
     return region;
 }
 
+QRegion BlurEffect::blurArea() const
+{
+    QRegion area;
+    m_records.forEach([this, &area](EffectWindow *w, const WindowRecord &record) {
+        if (record.blur) {
+            area += blurRegion(w).translated(w->pos().toPoint());
+        }
+    });
+    return area;
+}
+
+void BlurEffect::repaintBlurArea(const Output *screen)
+{
+    QRegion area = expandedRegion(blurArea(), m_expandSize);
+    if (screen) {
+        area &= screen->geometry();
+    }
+    if (!area.isEmpty()) {
+        effects->addRepaint(area);
+    }
+}
+
 void BlurEffect::prePaintScreen(ScreenPrePaintData &data, std::chrono::milliseconds presentTime)
 {
-    m_paintedArea = QRegion();
-    m_currentBlur = QRegion();
     m_currentScreen = effects->waylandDisplay() ? data.screen : nullptr;
+    m_frame = &m_screenFrames[m_currentScreen];
+    *m_frame = ScreenFrameState();
+    m_frame->paused = updateFullScreenPause(m_currentScreen);
+    m_presentTime = presentTime;
+    m_statistics.beginFrame(data.screen);
+    if (m_debugOverlay) {
+        m_debugOverlay->beginFrame();
+    }
+    predictOcclusion();
 
     effects->prePaintScreen(data, presentTime);
 }
 
+void BlurEffect::predictOcclusion()
+{
+    m_predictedOpaque.clear();
+    m_occludedBlur.clear();
+    if (!m_engine || m_frame->paused) {
+        return;
+    }
+
+    std::vector<std::pair<EffectWindow *, const WindowRecord *>> windows;
+    m_records.forEach([&windows](EffectWindow *w, const WindowRecord &record) {
+        if (w->isOnCurrentDesktop() && w->isOnCurrentActivity() && !w->isMinimized()) {
+            windows.emplace_back(w, &record);
+        }
+    });
+    std::sort(windows.begin(), windows.end(), [](const auto &a, const auto &b) {
+        return a.first->window()->stackingOrder() > b.first->window()->stackingOrder();
+    });
+
+    QRegion opaque;
+    for (const auto &[w, record] : windows) {
+        if (!opaque.isEmpty() && record->blur) {
+            const QRegion blurArea = blurRegion(w).translated(w->pos().toPoint());
+
+            // The blur samples the background around the visible parts, it still has to be painted there.
+            const QRegion sampledArea = expandedRegion(blurArea - opaque, m_expandSize);
+            if (const QRegion hidden = blurArea - sampledArea; !hidden.isEmpty()) {
+                m_occludedBlur[w] = hidden;
+            }
+        }
+
+        if (!record->lastOpaque.isEmpty()) {
+            m_predictedOpaque[w] = record->lastOpaque;
+            opaque += record->lastOpaque;
+        }
+    }
+}
+
+void BlurEffect::revealOccludedBlur(WindowPrePaintData &data)
+{
+    for (const auto &[w, hidden] : m_occludedBlur) {
+        const bool prepared = std::any_of(m_frame->paintedWindows.cbegin(), m_frame->paintedWindows.cend(), [w](const PaintedWindow &painted) {
+            return painted.window == w;
+        });
+        if (prepared) {
+            data.paint += hidden;
+            m_frame->currentBlur += hidden;
+        }
+    }
+    m_occludedBlur.clear();
+    m_predictedOpaque.clear();
+}
+
+BlurEffectData *BlurEffect::blurData(const EffectWindow *w)
+{
+    WindowRecord *record = m_records.find(w);
+    return record && record->blur ? &*record->blur : nullptr;
+}
+
+const BlurEffectData *BlurEffect::blurData(const EffectWindow *w) const
+{
+    const WindowRecord *record = m_records.find(w);
+    return record && record->blur ? &*record->blur : nullptr;
+}
+
+QRegion BlurEffect::occludedBlurArea(EffectWindow *w) const
+{
+    QRegion area;
+    if (auto it = m_occludedBlur.find(w); it != m_occludedBlur.end()) {
+        area = it->second;
+    }
+    if (const BlurEffectData *blurInfo = blurData(w)) {
+        area += blurInfo->opaque;
+    }
+    return area;
+}
+
+void BlurEffect::paintScreen(const RenderTarget &renderTarget, const RenderViewport &viewport, int mask, const QRegion &region, Output *screen)
+{
+    // Windows that were predicted to hide blur regions, but weren't prepared for painting, aren't painted at all. It's
+    // too late to repaint what's behind them in this frame.
+    if (!m_predictedOpaque.empty() && !m_occludedBlur.empty()) {
+        for (const auto &[w, hidden] : m_occludedBlur) {
+            effects->addRepaint(m_currentScreen ? hidden & m_currentScreen->geometry() : hidden);
+        }
+        for (const auto &[w, opaque] : m_predictedOpaque) {
+            if (WindowRecord *record = m_records.find(w)) {
+                record->lastOpaque = QRegion();
+            }
+        }
+        m_occludedBlur.clear();
+    }
+    m_predictedOpaque.clear();
+
+    m_frame->paintRegion = region;
+    m_batch.reset();
+    m_batchPosition = 0;
+    m_batchBlurred = false;
+
+    // Windows are painted in their entirety when the screen is transformed, the regions used for fetching the
+    // backgrounds of the batch wouldn't be correct.
+    if (!(mask & (PAINT_SCREEN_TRANSFORMED | PAINT_SCREEN_WITH_TRANSFORMED_WINDOWS))) {
+        planBatch(renderTarget, viewport);
+    }
+
+    m_frame->framebuffer = renderTarget.framebuffer();
+    effects->paintScreen(renderTarget, viewport, mask, region, screen);
+    m_frame->framebuffer = nullptr;
+    m_batch.reset();
+
+    if (m_settings.general.memoryBudget > 0) {
+        freeIdleRenderTargets(s_idleTime, m_settings.general.memoryBudget);
+    }
+    m_statistics.endFrame();
+
+    if (m_debugOverlay) {
+        m_debugOverlay->paint(viewport, region);
+    }
+}
+
 void BlurEffect::prePaintWindow(EffectWindow *w, WindowPrePaintData &data, std::chrono::milliseconds presentTime)
 {
+    // Only the opaque region needs to be tracked, to notice when the full screen window stops covering the screen.
+    if (m_frame->paused) {
+        effects->prePaintWindow(w, data, presentTime);
+        const QRegion opaque = data.mask & (PAINT_WINDOW_TRANSFORMED | PAINT_WINDOW_TRANSLUCENT) ? QRegion() : data.opaque;
+        if (WindowRecord *record = m_records.find(w)) {
+            record->lastOpaque = opaque;
+        }
+
+        // The full screen window may become translucent or start to be transformed in this frame, before the windows
+        // behind it are drawn.
+        if (auto it = m_fullScreenPauses.find(m_currentScreen); it != m_fullScreenPauses.end() && it->second.window == w) {
+            if (w->opacity() < 1 || !(QRegion(m_currentScreen->geometry()) - opaque).isEmpty()) {
+                resumeFullScreenPause();
+            }
+        }
+        return;
+    }
+
     // this effect relies on prePaintWindow being called in the bottom to top order
+    BlurStatistics::Timer timer(m_statistics, BlurStatistics::Timing::PrePaintWindow);
 
     // in case this window has regions to be blurred
     const QRegion blurArea = blurRegion(w).translated(w->pos().toPoint());
+    if (!blurArea.isEmpty()) {
+        m_statistics.regionProcessed(blurArea.rectCount());
+    }
+
+    // The opaque parts of the surface and the decoration, only set if the window is fully opaque. The blur isn't
+    // visible behind them.
+    const QRegion contentOpaque = data.opaque;
+
+    if (m_settings.staticBlur.enable) {
+        if (m_settings.staticBlur.disableWhenWindowBehind) {
+            if (BlurEffectData *blurInfo = blurData(w)) {
+                // The contents of windows behind are spread by the blur, so the area around them needs to be blurred
+                // as well.
+                QRegion windowsBehind;
+                m_records.forEach([this, w, &windowsBehind](EffectWindow *other, const WindowRecord &) {
+                    if (w->window()->stackingOrder() <= other->window()->stackingOrder()
+                        || other->isDesktop()
+                        || !other->isOnCurrentDesktop()
+                        || !other->isOnCurrentActivity()
+                        || other->window()->resourceClass() == "xwaylandvideobridge"
+                        || other->isMinimized()) {
+                        return;
+                    }
+
+                    windowsBehind += other->frameGeometry().toRect().adjusted(-m_expandSize, -m_expandSize, m_expandSize, m_expandSize);
+                });
+                windowsBehind &= blurArea;
+
+                // Only the part of the blur area that switched between static and real blur needs to be repainted.
+                const QRegion changed = windowsBehind.xored(blurInfo->windowsBehind);
+                data.paint += changed;
+                data.opaque -= changed;
+                blurInfo->windowsBehind = windowsBehind;
+            }
+        }
+
+        if (m_settings.staticBlur.imageSource == StaticBlurImageSource::DesktopWallpaper && w->isDesktop() && w->frameGeometry() == data.paint.boundingRect()) {
+            m_staticBlurTextures.erase(m_currentScreen);
+        }
+    }
+
+    // The part of the blur area that is painted using the static blur texture, the rest is actually blurred.
+    QRegion staticBlurArea;
+    if (hasStaticBlur(w) && m_staticBlurTextures.contains(m_currentScreen)) {
+        staticBlurArea = blurArea;
+        if (const BlurEffectData *blurInfo = blurData(w)) {
+            staticBlurArea -= blurInfo->windowsBehind;
+        }
+    }
+    const QRegion realBlurArea = blurArea - staticBlurArea;
+    const bool staticBlur = !staticBlurArea.isEmpty() && realBlurArea.isEmpty();
 
-    bool staticBlur = hasStaticBlur(w) && m_staticBlurTextures.contains(m_currentScreen) && !blurArea.isEmpty();
-    if (staticBlur) {
+    if (!staticBlurArea.isEmpty()) {
         if (!m_settings.general.windowOpacityAffectsBlur) {
-            data.opaque += blurArea;
+            data.opaque += staticBlurArea;
         }
 
         int topCornerRadius;
@@ -562,202 +1111,1326 @@ void BlurEffect::prePaintWindow(EffectWindow *w, WindowPrePaintData &data, std::
         }
     }
 
-    if (m_settings.staticBlur.enable) {
-        if (m_settings.staticBlur.disableWhenWindowBehind) {
-            if (auto it = m_windows.find(w); it != m_windows.end()) {
-                const bool hadWindowBehind = it->second.hasWindowBehind;
-                it->second.hasWindowBehind = false;
-                for (EffectWindow *other : m_allWindows) {
-                    if (w->window()->stackingOrder() <= other->window()->stackingOrder()
-                        || other->isDesktop()
-                        || !other->isOnCurrentDesktop()
-                        || !other->isOnCurrentActivity()
-                        || other->window()->resourceClass() == "xwaylandvideobridge"
-                        || other->isMinimized()) {
-                        continue;
-                    }
+    if (m_settings.forceBlur.markWindowAsTranslucent && !staticBlur && shouldForceBlur(w)) {
+        data.setTranslucent();
+    }
 
-                    if (w->frameGeometry().intersects(other->frameGeometry())) {
-                        it->second.hasWindowBehind = true;
-                        break;
-                    }
-                }
+    timer.stop();
+    effects->prePaintWindow(w, data, presentTime);
+    timer.start();
 
-                if (hadWindowBehind != it->second.hasWindowBehind) {
-                    data.paint += blurArea;
-                    data.opaque -= blurArea;
-                }
-            }
+    const bool transformed = data.mask & PAINT_WINDOW_TRANSFORMED;
+    const QRegion opaque = transformed || (data.mask & PAINT_WINDOW_TRANSLUCENT) ? QRegion() : data.opaque;
+    if (auto it = m_predictedOpaque.find(w); it != m_predictedOpaque.end()) {
+        if (!(it->second - opaque).isEmpty()) {
+            revealOccludedBlur(data);
+        } else {
+            m_predictedOpaque.erase(it);
         }
+    }
+    BlurEffectData *blurInfo = nullptr;
+    if (WindowRecord *record = m_records.find(w)) {
+        record->lastOpaque = opaque;
+        if (record->blur) {
+            blurInfo = &*record->blur;
 
-        if (m_settings.staticBlur.imageSource == StaticBlurImageSource::DesktopWallpaper && w->isDesktop() && w->frameGeometry() == data.paint.boundingRect()) {
-            m_staticBlurTextures.erase(m_currentScreen);
+            // Render targets of windows painted in this frame can't be freed when another allocation fails.
+            if (auto it = blurInfo->render.find(m_currentScreen); it != blurInfo->render.end()) {
+                it->second.lastUsedTime = m_presentTime;
+            }
         }
     }
 
-    if (m_settings.forceBlur.markWindowAsTranslucent && !staticBlur && shouldForceBlur(w)) {
-        data.setTranslucent();
+    // The hidden part of the blur region is relative to the untransformed window.
+    QRegion visibleBlurArea = realBlurArea;
+    if (auto it = m_occludedBlur.find(w); it != m_occludedBlur.end()) {
+        if (transformed) {
+            m_occludedBlur.erase(it);
+        } else {
+            it->second &= realBlurArea;
+            visibleBlurArea -= it->second;
+        }
+    }
+    if (blurInfo) {
+        blurInfo->opaque = transformed ? QRegion() : contentOpaque & realBlurArea;
+        visibleBlurArea -= blurInfo->opaque;
+    }
+
+    if (!staticBlur) {
+        // The blur samples the background around the visible part, it has to be painted behind the opaque parts of
+        // the window as well.
+        if (!data.opaque.isEmpty() && visibleBlurArea != realBlurArea) {
+            data.opaque -= expandedRegion(visibleBlurArea, m_expandSize);
+        }
+
+        if (data.opaque.intersects(m_frame->currentBlur)) {
+            // to blur an area partially we have to shrink the opaque area of a window
+            QRegion newOpaque;
+            for (const QRect &rect : data.opaque) {
+                newOpaque += rect.adjusted(m_expandSize, m_expandSize, -m_expandSize, -m_expandSize);
+            }
+            data.opaque = newOpaque;
+
+            // we don't have to blur a region we don't see
+            m_frame->currentBlur -= newOpaque;
+        }
+
+        if (transformed) {
+            // The blur shape and the background are transformed, the blur is repainted completely.
+            if (m_frame->paintedArea.intersects(visibleBlurArea) || data.paint.intersects(visibleBlurArea)) {
+                data.paint += visibleBlurArea;
+            }
+        } else if (blurInfo) {
+            // The background is cached and only fetched where it's repainted. Everything needs to be repainted if
+            // there is no cache yet, as well as the parts of the blur region that weren't visible before.
+            const auto renderIt = blurInfo->render.find(m_currentScreen);
+            const bool cached = renderIt != blurInfo->render.end()
+                && !renderIt->second.textures.empty()
+                && renderIt->second.textures[0]->size() == blurArea.boundingRect().size();
+            QRegion &previousVisibleBlurArea = blurInfo->visibleBlurArea[m_currentScreen];
+            if (!cached) {
+                data.paint += visibleBlurArea;
+            } else if (const QRegion exposed = visibleBlurArea - previousVisibleBlurArea; !exposed.isEmpty()) {
+                data.paint += expandedRegion(exposed, m_expandSize) & visibleBlurArea;
+            }
+            previousVisibleBlurArea = visibleBlurArea;
+
+            // A change behind the window only affects the blur up to the distance the blur samples the background
+            // from. Repainting the window itself doesn't affect the blur, only the repainted pixels are drawn again.
+            const QRect sampledRect = visibleBlurArea.boundingRect().adjusted(-m_expandSize, -m_expandSize, m_expandSize, m_expandSize);
+            if (const QRegion damageBehind = m_frame->paintedArea & sampledRect; !damageBehind.isEmpty()) {
+                data.paint += expandedRegion(damageBehind, m_expandSize) & visibleBlurArea;
+            }
+        }
+
+        m_frame->currentBlur += visibleBlurArea;
+    }
+
+    m_frame->paintedArea -= data.opaque;
+    m_frame->paintedArea += data.paint;
+
+    if (m_debugOverlay && !blurArea.isEmpty()) {
+        m_debugOverlay->window(w).repaintArea = data.paint & blurArea;
+    }
+
+    m_frame->paintedWindows.append(PaintedWindow{
+        .window = w,
+        .opaque = transformed || (data.mask & PAINT_WINDOW_TRANSLUCENT) ? QRegion() : data.opaque,
+        .transformed = transformed,
+    });
+}
+
+std::optional<SecondaryPassMode> BlurEffect::secondaryPassMode(const RenderTarget &renderTarget) const
+{
+    // Windows are only drawn while no screen is painted for screenshots and screencasts.
+    if (!m_frame || !m_frame->framebuffer) {
+        return m_settings.general.captureBlurMode;
+    }
+    if (renderTarget.framebuffer() != m_frame->framebuffer) {
+        return m_settings.general.thumbnailBlurMode;
+    }
+    return std::nullopt;
+}
+
+void BlurEffect::blurSecondaryPass(SecondaryPassMode mode, BlurEffectData &blurInfo, const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w, int mask, const QRegion &region, WindowPaintData &data)
+{
+    const QRegion blurShape = blurRegion(w).translated(w->pos().toPoint());
+    const QRect blurRect = blurShape.boundingRect();
+
+    // The result of the screen pass can only be drawn if the whole blur region was blurred at its current position.
+    // Windows blurred as part of a batch have their result in the render targets of the batch.
+    Output *screen = nullptr;
+    BlurRenderData *screenRender = nullptr;
+    if (mode == SecondaryPassMode::Reuse) {
+        for (auto &[output, renderInfo] : blurInfo.render) {
+            if (!renderInfo.framebuffers.empty() && (blurShape - renderInfo.blurredArea).isEmpty()) {
+                screen = output;
+                screenRender = &renderInfo;
+                break;
+            }
+        }
+
+        const bool transformed = (mask & PAINT_WINDOW_TRANSFORMED) || data.xScale() != 1 || data.yScale() != 1 || data.xTranslation() || data.yTranslation();
+        if (!screenRender && !transformed) {
+            for (auto &[output, renderData] : m_batchRender) {
+                if (renderData.render.framebuffers.empty() || !renderData.batch || !(blurShape - renderData.render.blurredArea).isEmpty()) {
+                    continue;
+                }
+
+                const qsizetype index = renderData.batch->windows.indexOf(w);
+                if (index != -1 && renderData.batch->shapes[index] == blurShape) {
+                    drawBatched(renderData, blurShape, blurShape, viewport, w, region, data);
+                    return;
+                }
+            }
+        }
+    }
+    if (!screenRender && effects->waylandDisplay()) {
+        screen = effects->screenAt(blurRect.center());
+    }
+
+    // The static blur texture and its position are taken from the current screen.
+    Output *previousScreen = std::exchange(m_currentScreen, screen);
+    if (screenRender) {
+        blur(*screenRender, renderTarget, viewport, w, mask, region, data, BlurPass::ReuseScreen);
+    } else {
+        blur(m_secondaryRender, renderTarget, viewport, w, mask, region, data, mode == SecondaryPassMode::Static ? BlurPass::Static : BlurPass::Full);
+    }
+    m_currentScreen = previousScreen;
+}
+
+bool BlurEffect::shouldBlur(const EffectWindow *w, int mask, const WindowPaintData &data)
+{
+    const bool hasForceBlurRole = w->data(WindowForceBlurRole).toBool();
+    if ((effects->activeFullScreenEffect() && !hasForceBlurRole) || w->isDesktop()) {
+        return false;
+    }
+
+    bool scaled = !qFuzzyCompare(data.xScale(), 1.0) && !qFuzzyCompare(data.yScale(), 1.0);
+    bool translated = data.xTranslation() || data.yTranslation();
+    WindowRecord *record = m_records.find(w);
+    if (!(scaled || (translated || (mask & PAINT_WINDOW_TRANSFORMED)))) {
+        if (record) {
+            record->blurWhenTransformed = false;
+        }
+
+        return true;
+    }
+
+    // The force blur role may be removed while the window is still transformed, causing the blur to disappear for
+    // a short time. To avoid that, we allow the window to be blurred until it's not transformed anymore.
+    if (record && record->blurWhenTransformed) {
+        return true;
+    } else if (hasForceBlurRole && record) {
+        record->blurWhenTransformed = true;
+    }
+
+    return hasForceBlurRole;
+}
+
+bool BlurEffect::shouldForceBlur(const EffectWindow *w) const
+{
+    return shouldForceBlur(w, m_settings.forceBlur);
+}
+
+bool BlurEffect::shouldForceBlur(const EffectWindow *w, const ForceBlurSettings &settings) const
+{
+    if (w->isDesktop() || (!settings.blurDocks && w->isDock()) || (!settings.blurMenus && isMenu(w))) {
+        return false;
+    }
+
+    bool matches = settings.windowClasses.contains(w->window()->resourceName())
+        || settings.windowClasses.contains(w->window()->resourceClass());
+    return (matches && settings.windowClassMatchingMode == WindowClassMatchingMode::Whitelist)
+        || (!matches && settings.windowClassMatchingMode == WindowClassMatchingMode::Blacklist);
+}
+
+void BlurEffect::drawWindow(const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w, int mask, const QRegion &region, WindowPaintData &data)
+{
+    if (const std::optional<SecondaryPassMode> mode = secondaryPassMode(renderTarget)) {
+        BlurEffectData *blurInfo = blurData(w);
+        if (blurInfo && shouldBlur(w, mask, data)) {
+            blurSecondaryPass(*mode, *blurInfo, renderTarget, viewport, w, mask, region, data);
+        }
+        effects->drawWindow(renderTarget, viewport, w, mask, region, data);
+        return;
+    }
+
+    if (m_frame->paused) {
+        effects->drawWindow(renderTarget, viewport, w, mask, region, data);
+        return;
+    }
+
+    qsizetype batchIndex = advanceBatch(w);
+
+    if (BlurEffectData *blurInfo = blurData(w)) {
+        BlurRenderData &renderInfo = blurInfo->render[m_currentScreen];
+
+        // The content isn't opaque if the window is faded. The background of the batch was processed without the
+        // opaque parts.
+        if (data.opacity() != 1 && !blurInfo->opaque.isEmpty()) {
+            blurInfo->opaque = QRegion();
+            if (batchIndex != -1) {
+                m_batch.reset();
+                batchIndex = -1;
+            }
+        }
+
+        if (shouldBlur(w, mask, data)) {
+            BlurStatistics::Timer timer(m_statistics, BlurStatistics::Timing::Blur);
+            m_statistics.windowBlurred();
+            if (m_debugOverlay) {
+                m_debugOverlay->beginGpuTimer(w);
+            }
+            if (!(batchIndex != -1 && blurBatched(batchIndex, renderTarget, viewport, w, mask, region, data))) {
+                blur(renderInfo, renderTarget, viewport, w, mask, region, data);
+            }
+            if (m_debugOverlay) {
+                m_debugOverlay->endGpuTimer();
+            }
+        }
+    }
+
+    // Draw the window over the blurred area
+    effects->drawWindow(renderTarget, viewport, w, mask, region, data);
+}
+
+void BlurEffect::planBatch(const RenderTarget &renderTarget, const RenderViewport &viewport)
+{
+    if (!m_engine || effects->activeFullScreenEffect()) {
+        m_batchRender.erase(m_currentScreen);
+        return;
+    }
+
+    // Find the first sequence of at least two blurred windows painted directly after each other, where no window is
+    // painted over the background of a window above it.
+    BlurBatch batch;
+    QRegion batchGeometry;
+    for (const PaintedWindow &painted : std::as_const(m_frame->paintedWindows)) {
+        EffectWindow *w = painted.window;
+        QRegion shape;
+        if (!painted.transformed && blurData(w) && !hasStaticBlur(w)) {
+            shape = blurRegion(w).translated(w->pos().toPoint());
+        }
+
+        const QRect expandedShapeRect = shape.boundingRect().adjusted(-m_expandSize, -m_expandSize, m_expandSize, m_expandSize);
+        if (!shape.isEmpty() && !batch.windows.isEmpty() && !batchGeometry.intersects(expandedShapeRect)) {
+            batch.windows.append(w);
+            batch.shapes.append(shape);
+            batchGeometry += w->expandedGeometry().toAlignedRect();
+            continue;
+        }
+        if (batch.windows.size() >= 2) {
+            break;
+        }
+
+        batch = BlurBatch();
+        batchGeometry = QRegion();
+        if (!shape.isEmpty()) {
+            batch.windows.append(w);
+            batch.shapes.append(shape);
+            batchGeometry = w->expandedGeometry().toAlignedRect();
+        }
+    }
+    if (batch.windows.size() < 2) {
+        m_batchRender.erase(m_currentScreen);
+        return;
+    }
+
+    // The shared background only covers the area the windows sample.
+    const QRect screenRect = viewport.renderRect().toRect();
+    QRect backgroundRect;
+    for (const QRegion &shape : std::as_const(batch.shapes)) {
+        backgroundRect |= batchProcessingRect(shape, screenRect);
+    }
+
+    // The windows keep their own render targets in case they're blurred separately, so the shared one is additional
+    // memory. Blurring them together is only worth it if it fits in the budget.
+    if (m_settings.general.memoryBudget > 0) {
+        GLenum textureFormat = GL_RGBA8;
+        if (renderTarget.texture()) {
+            textureFormat = renderTarget.texture()->internalFormat();
+        }
+
+        qint64 usage = memoryUsage().total();
+        if (auto it = m_batchRender.find(m_currentScreen); it != m_batchRender.end()) {
+            for (const auto &texture : it->second.render.textures) {
+                usage -= textureBytes(texture.get());
+            }
+        }
+        for (const BlurRenderTarget &target : m_engine->renderTargets(backgroundRect.size())) {
+            usage += textureBytes(textureFormat, target.size, target.mipmaps);
+        }
+        if (usage > m_settings.general.memoryBudget) {
+            m_batchRender.erase(m_currentScreen);
+            return;
+        }
+    }
+
+    BlurBatchRenderData &renderData = m_batchRender[m_currentScreen];
+    if (renderData.batch != batch || renderData.backgroundRect != backgroundRect) {
+        renderData.batch.reset();
+        renderData.backgroundRect = backgroundRect;
+
+        // The background is only fetched where the screen is repainted, it can be used once all of it was fetched.
+        QRegion processingRegion;
+        for (const QRegion &shape : std::as_const(batch.shapes)) {
+            processingRegion += batchProcessingRect(shape, backgroundRect);
+        }
+        if (!(processingRegion - m_frame->paintRegion).isEmpty()) {
+            effects->addRepaint(processingRegion);
+            return;
+        }
+    }
+
+    m_batch = batch;
+}
+
+qsizetype BlurEffect::advanceBatch(EffectWindow *w)
+{
+    if (!m_batch) {
+        return -1;
+    }
+
+    const qsizetype index = m_batch->windows.indexOf(w, m_batchPosition);
+    if (index == -1) {
+        // Windows below the batch are drawn before it. Any other window could be drawn over the backgrounds of the
+        // remaining windows, which are then blurred separately.
+        if (m_batchBlurred) {
+            m_batch.reset();
+        }
+        return -1;
+    }
+
+    m_batchPosition = index + 1;
+    return index;
+}
+
+QRect BlurEffect::batchProcessingRect(const QRegion &shape, const QRect &backgroundRect) const
+{
+    // Unlike in blur(), the area around the shape isn't clamped to the shape, because the background texture is shared.
+    return shape.boundingRect().adjusted(-m_expandSize, -m_expandSize, m_expandSize, m_expandSize) & backgroundRect;
+}
+
+QRegion BlurEffect::backgroundPaintRegion(EffectWindow *w) const
+{
+    // The region passed to drawWindow() is only known for the window being drawn. The screen is painted everywhere
+    // it's repainted, except under the opaque parts of windows above.
+    QRegion region = m_frame->paintRegion;
+    bool above = false;
+    for (const PaintedWindow &painted : m_frame->paintedWindows) {
+        if (above) {
+            region -= painted.opaque;
+        }
+        above = above || painted.window == w;
+    }
+    return region;
+}
+
+void BlurEffect::updateBatchBackground(const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w)
+{
+    auto it = m_batchRender.find(m_currentScreen);
+    if (it == m_batchRender.end() || !it->second.batch || it->second.render.framebuffers.empty()) {
+        return;
+    }
+    BlurBatchRenderData &renderData = it->second;
+    const qsizetype index = renderData.batch->windows.indexOf(w);
+    if (index == -1) {
+        return;
+    }
+
+    const QRegion shape = renderData.batch->shapes[index] - occludedBlurArea(w);
+    const QRegion dirtyRegion = backgroundPaintRegion(w) & batchProcessingRect(shape, renderData.backgroundRect);
+    for (const QRect &dirtyRect : dirtyRegion) {
+        renderData.render.framebuffers[0]->blitFromRenderTarget(renderTarget, viewport, dirtyRect, dirtyRect.translated(-renderData.backgroundRect.topLeft()));
+    }
+}
+
+bool BlurEffect::blurBatch(qsizetype first, const RenderTarget &renderTarget, const RenderViewport &viewport)
+{
+    BlurBatchRenderData &renderData = m_batchRender[m_currentScreen];
+    const QRect backgroundRect = renderData.backgroundRect;
+
+    GLenum textureFormat = GL_RGBA8;
+    if (renderTarget.texture()) {
+        textureFormat = renderTarget.texture()->internalFormat();
+    }
+    // New batches are only used when their whole background is repainted, see planBatch(). If the format of the
+    // render target changed, the background has to be fetched completely again.
+    if (renderData.batch && !renderData.render.textures.empty() && renderData.render.textures[0]->internalFormat() != textureFormat) {
+        m_batchRender.erase(m_currentScreen);
+        effects->addRepaint(backgroundRect);
+        return false;
+    }
+    if (!ensureRenderTargets(renderData.render, m_engine->renderTargets(backgroundRect.size()), textureFormat)) {
+        m_batchRender.erase(m_currentScreen);
+        return false;
+    }
+
+    // Windows before the first one that is blurred were already drawn over their backgrounds, which can't be fetched
+    // anymore.
+    if (first > 0) {
+        renderData.batch.reset();
+    } else {
+        renderData.batch = m_batch;
+    }
+
+    QList<QRect> processingRects;
+    for (qsizetype i = first; i < m_batch->windows.size(); ++i) {
+        EffectWindow *w = m_batch->windows[i];
+        const QRegion &shape = m_batch->shapes[i];
+        const QRegion visibleShape = shape - occludedBlurArea(w);
+        const QRect processingRect = batchProcessingRect(visibleShape, backgroundRect);
+        const QRegion paintRegion = backgroundPaintRegion(w);
+
+        // The separate background of the window is updated as well, in case it's blurred separately later.
+        BlurRenderData *windowRenderData = nullptr;
+        if (BlurEffectData *blurInfo = blurData(w)) {
+            if (auto renderIt = blurInfo->render.find(m_currentScreen); renderIt != blurInfo->render.end()) {
+                if (!renderIt->second.framebuffers.empty() && renderIt->second.textures[0]->size() == shape.boundingRect().size()) {
+                    windowRenderData = &renderIt->second;
+                }
+            }
+        }
+
+        for (const QRect &dirtyRect : paintRegion & processingRect) {
+            renderData.render.framebuffers[0]->blitFromRenderTarget(renderTarget, viewport, dirtyRect, dirtyRect.translated(-backgroundRect.topLeft()));
+        }
+        if (windowRenderData) {
+            const QRegion dirtyRegion = paintRegion & visibleShape.boundingRect();
+            for (const QRect &dirtyRect : dirtyRegion) {
+                windowRenderData->framebuffers[0]->blitFromRenderTarget(renderTarget, viewport, dirtyRect, dirtyRect.translated(-shape.boundingRect().topLeft()));
+            }
+
+            // The separate blur of the window is older than its background now, it can't be reused.
+            if (!dirtyRegion.isEmpty()) {
+                windowRenderData->blurredArea = QRegion();
+            }
+        }
+
+        // Windows that aren't repainted don't need to be blurred.
+        if (visibleShape.intersects(m_frame->paintRegion)) {
+            processingRects.append(processingRect);
+        }
+    }
+    if (processingRects.isEmpty()) {
+        return true;
+    }
+
+    QRegion processingRegion;
+    for (const QRect &processingRect : std::as_const(processingRects)) {
+        processingRegion += processingRect;
+    }
+    if (canReuseBlur(renderData.render, processingRegion)) {
+        effects->addRepaint(processingRegion);
+        return true;
+    }
+
+    GLVertexBuffer *vbo = GLVertexBuffer::streamingBuffer();
+    vbo->reset();
+    vbo->setAttribLayout(std::span(GLVertexBuffer::GLVertex2DLayout), sizeof(GLVertex2D));
+
+    if (auto result = vbo->map<GLVertex2D>(processingRects.size() * 6)) {
+        auto map = *result;
+
+        size_t vboIndex = 0;
+        for (const QRect &processingRect : std::as_const(processingRects)) {
+            addQuad(map, vboIndex, QRectF(processingRect.translated(-backgroundRect.topLeft())), backgroundRect.size());
+        }
+
+        vbo->unmap();
+    } else {
+        qCWarning(KWIN_BLUR) << "Failed to map vertex buffer";
+        return false;
+    }
+
+    vbo->bindArrays();
+    m_engine->blur(renderData.render, vbo, processingRects.size() * 6, processingRegion.boundingRect().translated(-backgroundRect.topLeft()), backgroundRect.size(), m_colorMatrix);
+    vbo->unbindArrays();
+
+    renderData.render.blurredArea = processingRegion;
+    renderData.render.blurTime = m_presentTime;
+    renderData.render.lastUsedTime = m_presentTime;
+    return true;
+}
+
+bool BlurEffect::canReuseBlur(const BlurRenderData &renderInfo, const QRegion &processingRegion) const
+{
+    if (m_settings.general.maxUpdateRate <= 0 || renderInfo.blurTime > m_presentTime) {
+        return false;
+    }
+
+    const std::chrono::milliseconds interval(1000 / m_settings.general.maxUpdateRate);
+    return m_presentTime - renderInfo.blurTime < interval && (processingRegion - renderInfo.blurredArea).isEmpty();
+}
+
+bool BlurEffect::blurBatched(qsizetype index, const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w, int mask, const QRegion &region, WindowPaintData &data)
+{
+    // A transformed window is drawn outside of the area that was checked for overlapping the other windows.
+    if ((mask & PAINT_WINDOW_TRANSFORMED) || data.xScale() != 1 || data.yScale() != 1 || data.xTranslation() || data.yTranslation()) {
+        m_batch.reset();
+        return false;
+    }
+
+    const bool blursBatch = !m_batchBlurred;
+    if (!m_batchBlurred) {
+        if (!blurBatch(index, renderTarget, viewport)) {
+            m_batch.reset();
+            return false;
+        }
+        m_batchBlurred = true;
+    }
+
+    BlurBatchRenderData &renderData = m_batchRender[m_currentScreen];
+    const QRegion &blurShape = m_batch->shapes[index];
+    if (!drawBatched(renderData, blurShape, blurShape - occludedBlurArea(w), viewport, w, region, data)) {
+        return true;
+    }
+
+    if (m_debugOverlay) {
+        // The batch is blurred together with the first window that is drawn, in one pass for all windows.
+        const bool blurred = renderData.render.blurTime == m_presentTime;
+        const QRegion occluded = occludedBlurArea(w);
+        BlurDebugWindow &debugInfo = m_debugOverlay->window(w);
+        (blurred ? debugInfo.blurredArea : debugInfo.reusedArea) = (blurShape - occluded) & region;
+        debugInfo.occludedArea = blurShape & occluded & region;
+        debugInfo.backgroundRect = renderData.backgroundRect;
+        debugInfo.passes = 1 + (blursBatch && blurred ? m_engine->blurPassCount() : 0);
+    }
+    return true;
+}
+
+bool BlurEffect::drawBatched(BlurBatchRenderData &renderData, const QRegion &blurShape, const QRegion &paintedArea, const RenderViewport &viewport, EffectWindow *w, const QRegion &region, const WindowPaintData &data)
+{
+    const QRect backgroundRect = renderData.backgroundRect;
+    const QRect deviceBackgroundRect = snapToPixelGrid(scaledRect(backgroundRect, viewport.scale()));
+
+    const QList<QRectF> paintedShape = effectiveShape(paintedArea, region, viewport, backgroundRect, deviceBackgroundRect);
+    if (paintedShape.isEmpty()) {
+        return false;
+    }
+
+    GLVertexBuffer *vbo = GLVertexBuffer::streamingBuffer();
+    vbo->reset();
+    vbo->setAttribLayout(std::span(GLVertexBuffer::GLVertex2DLayout), sizeof(GLVertex2D));
+
+    const int vertexCount = paintedShape.size() * 6;
+    if (auto result = vbo->map<GLVertex2D>(vertexCount)) {
+        auto map = *result;
+
+        size_t vboIndex = 0;
+        for (const QRectF &rect : paintedShape) {
+            addQuad(map, vboIndex, rect, deviceBackgroundRect.size());
+        }
+
+        vbo->unmap();
+    } else {
+        qCWarning(KWIN_BLUR) << "Failed to map vertex buffer";
+        return false;
+    }
+
+    const QRect shapeRect = blurShape.boundingRect();
+    const auto [topCornerRadius, bottomCornerRadius] = cornerRadii(w, blurShape, viewport);
+
+    BlurDrawParameters parameters;
+    parameters.projectionMatrix = viewport.projectionMatrix();
+    parameters.projectionMatrix.translate(deviceBackgroundRect.x(), deviceBackgroundRect.y());
+    parameters.blurSize = backgroundRect.size();
+    parameters.blurRect = QRectF(shapeRect.x() - backgroundRect.x(),
+                                 backgroundRect.y() + backgroundRect.height() - shapeRect.y() - shapeRect.height(),
+                                 shapeRect.width(),
+                                 shapeRect.height());
+    parameters.scale = viewport.scale();
+    parameters.topCornerRadius = topCornerRadius;
+    parameters.bottomCornerRadius = bottomCornerRadius;
+    parameters.antialiasing = m_settings.roundedCorners.antialiasing;
+    parameters.opacity = m_settings.general.windowOpacityAffectsBlur ? w->opacity() * data.opacity() : data.opacity();
+    if (m_settings.general.noiseStrength > 0) {
+        parameters.noiseTexture = ensureNoiseTexture();
+    }
+
+    vbo->bindArrays();
+    m_engine->draw(renderData.render, vbo, 0, vertexCount, parameters);
+    vbo->unbindArrays();
+    return true;
+}
+
+StaticBlurTexture *BlurEffect::ensureStaticBlurTexture(const Output *output, const RenderTarget &renderTarget)
+{
+    if (auto it = m_staticBlurTextures.find(output); it != m_staticBlurTextures.end()) {
+        return it->second.get();
+    }
+
+    if (effects->waylandDisplay() && !output) {
+        return nullptr;
+    }
+
+    GLenum textureFormat = GL_RGBA8;
+    if (renderTarget.texture()) {
+        textureFormat = renderTarget.texture()->internalFormat();
+    }
+
+    std::optional<ColorDescription> colorDescription;
+    if (effects->waylandDisplay()) {
+        colorDescription = renderTarget.colorDescription();
+    }
+
+    // Identify the source image. Wallpapers can only be identified by their contents, so they're only hashed if
+    // another output could share the texture.
+    QByteArray sourceKey;
+    std::unique_ptr<GLTexture> source;
+    if (m_settings.staticBlur.imageSource == StaticBlurImageSource::Custom) {
+        sourceKey = m_imageLoader.key();
+    } else if (effects->waylandDisplay()) {
+        source = staticBlurSourceTexture(output, textureFormat);
+        if (!source) {
+            return nullptr;
+        }
+
+        const auto screens = effects->screens();
+        const bool hasIdenticalOutput = std::any_of(screens.begin(), screens.end(), [output](const Output *other) {
+            return other != output && other->pixelSize() == output->pixelSize() && other->scale() == output->scale();
+        });
+        if (hasIdenticalOutput) {
+            const QImage image = source->toImage();
+            QByteArray data;
+            QDataStream stream(&data, QIODevice::WriteOnly);
+            stream << image.size() << quint64(qHashBits(image.constBits(), image.sizeInBytes(), 0));
+            sourceKey = data;
+        }
+    }
+
+    QByteArray key;
+    if (!sourceKey.isEmpty()) {
+        key = staticBlurTextureKey(output, sourceKey, textureFormat);
+        for (const auto &[otherOutput, texture] : m_staticBlurTextures) {
+            if (texture->key == key && texture->colorDescription == colorDescription) {
+                m_statistics.staticBlurTextureShared();
+                return (m_staticBlurTextures[output] = texture).get();
+            }
+        }
+    }
+
+    // Textures are read back as 8-bit RGBA, and since the color space transformation is baked into them, only sRGB
+    // render targets can share cached images.
+    const bool cacheable = m_settings.staticBlur.diskCache
+        && m_settings.staticBlur.imageSource == StaticBlurImageSource::Custom
+        && !key.isEmpty()
+        && textureFormat == GL_RGBA8
+        && (!colorDescription || *colorDescription == ColorDescription::sRGB);
+
+    QSize size;
+    std::unique_ptr<GLTexture> texture;
+    // The texture may not be created until the custom image has been decoded in the background, which takes many
+    // frames. The cache is only looked up once per key in the meantime.
+    if (cacheable && !m_staticBlurCacheMisses.contains(key)) {
+        if (const QImage image = m_staticBlurCache.load(key); !image.isNull()) {
+            texture = GLTexture::upload(image);
+            size = staticBlurTextureSize(output);
+            m_statistics.staticBlurTextureLoadedFromCache();
+        } else {
+            m_staticBlurCacheMisses.insert(key);
+        }
+    }
+
+    if (!texture) {
+        if (effects->waylandDisplay()) {
+            if (!source) {
+                source = staticBlurSourceTexture(output, textureFormat);
+            }
+            texture.reset(createStaticBlurTextureWayland(std::move(source), renderTarget, textureFormat));
+        } else {
+            texture.reset(createStaticBlurTextureX11(textureFormat));
+        }
+        if (!texture) {
+            return nullptr;
+        }
+        size = texture->size();
+        m_statistics.staticBlurTextureCreated();
+
+        if (m_settings.staticBlur.textureScale < 1.0) {
+            const QSize reducedSize = (QSizeF(size) * m_settings.staticBlur.textureScale).toSize().expandedTo(QSize(1, 1));
+            if (auto reducedTexture = copyTexture(texture.get(), reducedSize, textureFormat)) {
+                texture = std::move(reducedTexture);
+            }
+        }
+
+        if (cacheable) {
+            m_staticBlurCache.store(key, texture->toImage());
+            m_staticBlurCacheMisses.remove(key);
+        }
+    }
+
+    if (m_settings.staticBlur.compactTextureFormat) {
+        // The alpha channel of the static blur texture is never sampled.
+        const GLenum compactFormat = textureFormat == GL_RGBA16F ? GL_R11F_G11F_B10F : GL_RGB565;
+        if (auto compactTexture = copyTexture(texture.get(), texture->size(), compactFormat)) {
+            texture = std::move(compactTexture);
+        }
+    }
+
+    texture->setFilter(GL_LINEAR);
+    texture->setWrapMode(GL_CLAMP_TO_EDGE);
+
+    // The scaled custom images are no longer needed once every output has a texture.
+    const auto screens = effects->screens();
+    if (!effects->waylandDisplay() || std::all_of(screens.begin(), screens.end(), [this, output](const Output *screen) {
+            return screen == output || m_staticBlurTextures.contains(screen);
+        })) {
+        m_imageLoader.releaseScaledImages();
+    }
+
+    auto staticBlurTexture = std::make_shared<StaticBlurTexture>();
+    staticBlurTexture->texture = std::move(texture);
+    staticBlurTexture->size = size;
+    staticBlurTexture->key = key;
+    staticBlurTexture->colorDescription = colorDescription;
+    return (m_staticBlurTextures[output] = std::move(staticBlurTexture)).get();
+}
+
+QSize BlurEffect::staticBlurTextureSize(const Output *output) const
+{
+    if (output) {
+        return output->pixelSize();
+    }
+
+    QRegion desktopGeometries;
+    for (auto *w : effects->stackingOrder()) {
+        if (w && w->isDesktop()) {
+            desktopGeometries += w->frameGeometry().toRect();
+        }
+    }
+    return desktopGeometries.boundingRect().size();
+}
+
+std::unique_ptr<GLTexture> BlurEffect::copyTexture(GLTexture *texture, const QSize &size, const GLenum &textureFormat, const QMatrix4x4 *colorMatrix)
+{
+    if (colorMatrix && !ensureColorMatrixShader()) {
+        return nullptr;
+    }
+
+    auto copy = GLTexture::allocate(textureFormat, size);
+    if (!copy) {
+        return nullptr;
+    }
+    auto framebuffer = std::make_unique<GLFramebuffer>(copy.get());
+    if (!framebuffer->valid()) {
+        return nullptr;
+    }
+
+    GLVertexBuffer *vbo = GLVertexBuffer::streamingBuffer();
+    vbo->reset();
+    vbo->setAttribLayout(std::span(GLVertexBuffer::GLVertex2DLayout), sizeof(GLVertex2D));
+
+    // Texture coordinates are specified explicitly instead of using GLTexture::render, so that the row order of the
+    // texture is preserved regardless of where it came from.
+    if (auto result = vbo->map<GLVertex2D>(6)) {
+        auto map = *result;
+        map[0] = GLVertex2D{.position = QVector2D(0, 0), .texcoord = QVector2D(0, 1)};
+        map[1] = GLVertex2D{.position = QVector2D(size.width(), size.height()), .texcoord = QVector2D(1, 0)};
+        map[2] = GLVertex2D{.position = QVector2D(0, size.height()), .texcoord = QVector2D(0, 0)};
+        map[3] = GLVertex2D{.position = QVector2D(0, 0), .texcoord = QVector2D(0, 1)};
+        map[4] = GLVertex2D{.position = QVector2D(size.width(), 0), .texcoord = QVector2D(1, 1)};
+        map[5] = GLVertex2D{.position = QVector2D(size.width(), size.height()), .texcoord = QVector2D(1, 0)};
+        vbo->unmap();
+    } else {
+        qCWarning(KWIN_BLUR) << "Failed to map vertex buffer";
+        return nullptr;
+    }
+
+    QMatrix4x4 projectionMatrix;
+    projectionMatrix.ortho(QRectF(0.0, 0.0, size.width(), size.height()));
+
+    if (colorMatrix) {
+        ShaderManager::instance()->pushShader(m_colorMatrixPass.shader.get());
+        m_colorMatrixPass.shader->setUniform(m_colorMatrixPass.mvpMatrixLocation, projectionMatrix);
+        m_colorMatrixPass.shader->setUniform(m_colorMatrixPass.colorMatrixLocation, *colorMatrix);
+    } else {
+        ShaderManager::instance()->pushShader(ShaderTrait::MapTexture)->setUniform(GLShader::Mat4Uniform::ModelViewProjectionMatrix, projectionMatrix);
+    }
+
+    texture->setFilter(GL_LINEAR);
+    texture->bind();
+
+    GLFramebuffer::pushFramebuffer(framebuffer.get());
+    vbo->bindArrays();
+    vbo->draw(GL_TRIANGLES, 0, 6);
+    vbo->unbindArrays();
+    GLFramebuffer::popFramebuffer();
+    ShaderManager::instance()->popShader();
+
+    return copy;
+}
+
+void BlurEffect::applyColorMatrix(std::unique_ptr<GLTexture> &texture, const GLenum &textureFormat)
+{
+    if (m_colorMatrix.isIdentity()) {
+        return;
+    }
+
+    if (auto transformedTexture = copyTexture(texture.get(), texture->size(), textureFormat, &m_colorMatrix)) {
+        texture = std::move(transformedTexture);
+    }
+}
+
+QByteArray BlurEffect::staticBlurTextureKey(const Output *output, const QByteArray &sourceKey, const GLenum &textureFormat) const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << sourceKey
+           << m_settings.staticBlur.blurCustomImage
+           << static_cast<int>(m_settings.general.algorithm);
+    // The CPU blur always uses the standard kernel, so the cached image can be reused when only the kernel changes.
+    const bool cpuBlurred = m_settings.staticBlur.imageSource == StaticBlurImageSource::Custom && m_imageLoader.blursImages();
+    if (m_settings.staticBlur.blurCustomImage && !cpuBlurred) {
+        stream << static_cast<int>(m_settings.general.kernel);
+    }
+    stream << m_settings.general.blurStrength
+           << m_settings.general.noiseStrength
+           << m_colorMatrix
+           << m_settings.staticBlur.textureScale
+           << quint32(textureFormat);
+
+    if (output) {
+        stream << output->pixelSize() << output->scale();
+    } else {
+        for (auto *w : effects->stackingOrder()) {
+            if (w && w->isDesktop()) {
+                stream << w->frameGeometry();
+            }
+        }
+    }
+
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+GLTexture *BlurEffect::ensureNoiseTexture()
+{
+    if (m_settings.general.noiseStrength == 0) {
+        return nullptr;
+    }
+
+    const qreal scale = std::max(1.0, QGuiApplication::primaryScreen()->logicalDotsPerInch() / 96.0);
+    if (!noiseTexture || noiseTextureScale != scale || noiseTextureStength != m_settings.general.noiseStrength) {
+        // Init randomness based on time
+        std::srand((uint)QTime::currentTime().msec());
+
+        QImage noiseImage(QSize(256, 256), QImage::Format_Grayscale8);
+
+        for (int y = 0; y < noiseImage.height(); y++) {
+            uint8_t *noiseImageLine = (uint8_t *)noiseImage.scanLine(y);
+
+            for (int x = 0; x < noiseImage.width(); x++) {
+                noiseImageLine[x] = std::rand() % m_settings.general.noiseStrength;
+            }
+        }
+
+        noiseImage = noiseImage.scaled(noiseImage.size() * scale);
+
+        noiseTexture = GLTexture::upload(noiseImage);
+        if (!noiseTexture) {
+            return nullptr;
+        }
+        noiseTexture->setFilter(GL_NEAREST);
+        noiseTexture->setWrapMode(GL_REPEAT);
+        noiseTextureScale = scale;
+        noiseTextureStength = m_settings.general.noiseStrength;
+    }
+
+    return noiseTexture.get();
+}
+
+std::pair<float, float> BlurEffect::cornerRadii(const EffectWindow *w, const QRegion &blurShape, const RenderViewport &viewport) const
+{
+    float topCornerRadius = 0;
+    float bottomCornerRadius = 0;
+    if (w && !(w->isDock() && !isDockFloating(w, blurShape))) {
+        const bool isMaximized = effects->clientArea(MaximizeArea, effects->activeScreen(), effects->currentDesktop()) == w->frameGeometry();
+        if (isMenu(w)) {
+            topCornerRadius = bottomCornerRadius = m_settings.roundedCorners.menuRadius;
+        } else if (w->isDock()) {
+            topCornerRadius = bottomCornerRadius = m_settings.roundedCorners.dockRadius;
+        } else if ((!w->isFullScreen() && !isMaximized) || m_settings.roundedCorners.roundMaximized) {
+            if (!w->decoration() || (w->decoration() && m_settings.forceBlur.blurDecorations)) {
+                topCornerRadius = m_settings.roundedCorners.windowTopRadius;
+            }
+            bottomCornerRadius = m_settings.roundedCorners.windowBottomRadius;
+        }
+        topCornerRadius = topCornerRadius * viewport.scale();
+        bottomCornerRadius = bottomCornerRadius * viewport.scale();
+    }
+    return {topCornerRadius, bottomCornerRadius};
+}
+
+bool BlurEffect::ensureRenderTargets(BlurRenderData &renderInfo, const std::vector<BlurRenderTarget> &renderTargets, GLenum textureFormat)
+{
+    // Render data is cleared when the engine changes, so only the sizes need to be compared.
+    const auto renderTargetsMatch = [&renderInfo, &renderTargets, &textureFormat]() {
+        if (renderInfo.textures.size() != renderTargets.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < renderTargets.size(); ++i) {
+            if (renderInfo.textures[i]->size() != renderTargets[i].size || renderInfo.textures[i]->internalFormat() != textureFormat) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (renderTargetsMatch()) {
+        return true;
     }
 
-    effects->prePaintWindow(w, data, presentTime);
+    const bool reallocated = !renderInfo.textures.empty();
+    renderInfo.framebuffers.clear();
+    renderInfo.textures.clear();
+    renderInfo.blurredArea = QRegion();
+    renderInfo.lastUsedTime = m_presentTime;
 
-    if (!staticBlur) {
-        const QRegion oldOpaque = data.opaque;
-        if (data.opaque.intersects(m_currentBlur)) {
-            // to blur an area partially we have to shrink the opaque area of a window
-            QRegion newOpaque;
-            for (const QRect &rect : data.opaque) {
-                newOpaque += rect.adjusted(m_expandSize, m_expandSize, -m_expandSize, -m_expandSize);
-            }
-            data.opaque = newOpaque;
+    // Neither freeing memory nor reducing the strength helps with backgrounds larger than the maximum texture size, the
+    // first render target is always as large as the background.
+    if (m_maxTextureSize == 0) {
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &m_maxTextureSize);
+    }
+    if (!renderTargets.empty() && (renderTargets[0].size.width() > m_maxTextureSize || renderTargets[0].size.height() > m_maxTextureSize)) {
+        return false;
+    }
 
-            // we don't have to blur a region we don't see
-            m_currentBlur -= newOpaque;
+    for (const BlurRenderTarget &renderTarget : renderTargets) {
+        const int levels = renderTarget.mipmaps
+            ? static_cast<int>(std::floor(std::log2(std::max(renderTarget.size.width(), renderTarget.size.height())))) + 1
+            : 1;
+        auto texture = GLTexture::allocate(textureFormat, renderTarget.size, levels);
+        // Free the render targets of all windows that weren't painted in this frame and try again if that released
+        // anything.
+        if (!texture && freeIdleRenderTargets(std::chrono::milliseconds(1), 0) > 0) {
+            texture = GLTexture::allocate(textureFormat, renderTarget.size, levels);
+        }
+        if (!texture) {
+            renderInfo.framebuffers.clear();
+            renderInfo.textures.clear();
+
+            // Allocations usually keep failing for a while, the strength is only reduced once until one succeeds.
+            if (!m_allocationFailing) {
+                qCWarning(KWIN_BLUR) << "Failed to allocate an offscreen texture";
+                m_allocationFailing = true;
+                reduceStrength();
+            }
+            return false;
         }
+        texture->setFilter(renderTarget.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        texture->setWrapMode(GL_CLAMP_TO_EDGE);
 
-        // if we have to paint a non-opaque part of this window that hasWindowBehind with the
-        // currently blurred region we have to redraw the whole region
-        if ((data.paint - oldOpaque).intersects(m_currentBlur)) {
-            data.paint += m_currentBlur;
+        auto framebuffer = std::make_unique<GLFramebuffer>(texture.get());
+        if (!framebuffer->valid()) {
+            qCWarning(KWIN_BLUR) << "Failed to create an offscreen framebuffer";
+            renderInfo.framebuffers.clear();
+            renderInfo.textures.clear();
+            return false;
         }
+        renderInfo.textures.push_back(std::move(texture));
+        renderInfo.framebuffers.push_back(std::move(framebuffer));
+    }
+    m_allocationFailing = false;
+    m_statistics.renderTargetsAllocated(reallocated);
+    return true;
+}
 
-        // if this window or a window underneath the blurred area is painted again we have to
-        // blur everything
-        if (m_paintedArea.intersects(blurArea) || data.paint.intersects(blurArea)) {
-            data.paint += blurArea;
-            // we have to check again whether we do not damage a blurred area
-            // of a window
-            if (blurArea.intersects(m_currentBlur)) {
-                data.paint += m_currentBlur;
+BlurMemoryUsage BlurEffect::memoryUsage() const
+{
+    const auto renderTargetBytes = [](const BlurRenderData &renderInfo) {
+        qint64 bytes = 0;
+        for (const auto &texture : renderInfo.textures) {
+            bytes += textureBytes(texture.get());
+        }
+        return bytes;
+    };
+
+    BlurMemoryUsage usage;
+    usage.noiseTexture = textureBytes(noiseTexture.get());
+    m_records.forEach([&usage, &renderTargetBytes](const EffectWindow *, const WindowRecord &record) {
+        if (record.blur) {
+            for (const auto &[screen, renderInfo] : record.blur->render) {
+                usage.renderTargets += renderTargetBytes(renderInfo);
             }
         }
+    });
+    for (const auto &[screen, renderData] : m_batchRender) {
+        usage.batchRenderTargets += renderTargetBytes(renderData.render);
+    }
+    usage.renderTargets += renderTargetBytes(m_secondaryRender);
 
-        m_currentBlur += blurArea;
+    // Static blur textures can be shared by multiple outputs.
+    std::unordered_set<const StaticBlurTexture *> staticBlurTextures;
+    for (const auto &[output, texture] : m_staticBlurTextures) {
+        if (texture && staticBlurTextures.insert(texture.get()).second) {
+            usage.staticBlurTextures += textureBytes(texture->texture.get());
+        }
     }
+    return usage;
+}
+
+QVariantMap BlurEffect::statisticsGauges() const
+{
+    int blurredWindows = 0;
+    m_records.forEach([&blurredWindows](const EffectWindow *, const WindowRecord &record) {
+        if (record.blur) {
+            blurredWindows++;
+        }
+    });
 
-    m_paintedArea -= data.opaque;
-    m_paintedArea += data.paint;
+    const BlurMemoryUsage usage = memoryUsage();
+    return QVariantMap{
+        {QStringLiteral("trackedWindows"), qulonglong(m_records.size())},
+        {QStringLiteral("blurredWindows"), blurredWindows},
+        {QStringLiteral("renderTargetBytes"), usage.renderTargets},
+        {QStringLiteral("batchRenderTargetBytes"), usage.batchRenderTargets},
+        {QStringLiteral("staticBlurTextureBytes"), usage.staticBlurTextures},
+        {QStringLiteral("noiseTextureBytes"), usage.noiseTexture},
+    };
 }
 
-bool BlurEffect::shouldBlur(const EffectWindow *w, int mask, const WindowPaintData &data)
+bool BlurEffect::ensureTextureShader()
 {
-    const bool hasForceBlurRole = w->data(WindowForceBlurRole).toBool();
-    if ((effects->activeFullScreenEffect() && !hasForceBlurRole) || w->isDesktop()) {
+    if (m_texture.program || m_texture.loadFailed) {
+        return m_texture.program != 0;
+    }
+
+    m_texture.program = ProgramBinaryCache().buildProgram(QStringLiteral(":/effects/forceblur/shaders/vertex.vert"),
+                                                          QStringLiteral(":/effects/forceblur/shaders/texture.frag"));
+    if (!m_texture.program) {
+        qCWarning(KWIN_BLUR) << "Failed to load texture pass shader";
+        m_texture.loadFailed = true;
         return false;
     }
 
-    bool scaled = !qFuzzyCompare(data.xScale(), 1.0) && !qFuzzyCompare(data.yScale(), 1.0);
-    bool translated = data.xTranslation() || data.yTranslation();
-    if (!(scaled || (translated || (mask & PAINT_WINDOW_TRANSFORMED)))) {
-        if (m_blurWhenTransformed.contains(w)) {
-            m_blurWhenTransformed.removeOne(w);
-        }
+    m_texture.mvpMatrixLocation = glGetUniformLocation(m_texture.program, "modelViewProjectionMatrix");
+    m_texture.textureSizeLocation = glGetUniformLocation(m_texture.program, "textureSize");
+    m_texture.texStartPosLocation = glGetUniformLocation(m_texture.program, "texStartPos");
+    m_texture.blurSizeLocation = glGetUniformLocation(m_texture.program, "blurSize");
+    m_texture.scaleLocation = glGetUniformLocation(m_texture.program, "scale");
+    m_texture.topCornerRadiusLocation = glGetUniformLocation(m_texture.program, "topCornerRadius");
+    m_texture.bottomCornerRadiusLocation = glGetUniformLocation(m_texture.program, "bottomCornerRadius");
+    m_texture.antialiasingLocation = glGetUniformLocation(m_texture.program, "antialiasing");
+    m_texture.opacityLocation = glGetUniformLocation(m_texture.program, "opacity");
+    return true;
+}
 
-        return true;
+bool BlurEffect::ensureColorMatrixShader()
+{
+    if (m_colorMatrixPass.shader || m_colorMatrixPass.loadFailed) {
+        return m_colorMatrixPass.shader != nullptr;
     }
 
-    // The force blur role may be removed while the window is still transformed, causing the blur to disappear for
-    // a short time. To avoid that, we allow the window to be blurred until it's not transformed anymore.
-    if (m_blurWhenTransformed.contains(w)) {
-        return true;
-    } else if (hasForceBlurRole) {
-        m_blurWhenTransformed.append(w);
+    m_colorMatrixPass.shader = ShaderManager::instance()->generateShaderFromFile(ShaderTrait::MapTexture,
+                                                                                 QStringLiteral(":/effects/forceblur/shaders/vertex.vert"),
+                                                                                 QStringLiteral(":/effects/forceblur/shaders/colormatrix.frag"));
+    if (!m_colorMatrixPass.shader) {
+        qCWarning(KWIN_BLUR) << "Failed to load color matrix pass shader";
+        m_colorMatrixPass.loadFailed = true;
+        return false;
     }
 
-    return hasForceBlurRole;
+    m_colorMatrixPass.mvpMatrixLocation = m_colorMatrixPass.shader->uniformLocation("modelViewProjectionMatrix");
+    m_colorMatrixPass.colorMatrixLocation = m_colorMatrixPass.shader->uniformLocation("colorMatrix");
+    return true;
 }
 
-bool BlurEffect::shouldForceBlur(const EffectWindow *w) const
+void BlurEffect::toggleDebugOverlay()
 {
-    if (w->isDesktop() || (!m_settings.forceBlur.blurDocks && w->isDock()) || (!m_settings.forceBlur.blurMenus && isMenu(w))) {
-        return false;
+    if (!effects->makeOpenGLContextCurrent()) {
+        return;
     }
 
-    bool matches = m_settings.forceBlur.windowClasses.contains(w->window()->resourceName())
-        || m_settings.forceBlur.windowClasses.contains(w->window()->resourceClass());
-    return (matches && m_settings.forceBlur.windowClassMatchingMode == WindowClassMatchingMode::Whitelist)
-        || (!matches && m_settings.forceBlur.windowClassMatchingMode == WindowClassMatchingMode::Blacklist);
+    if (m_debugOverlay) {
+        m_debugOverlay.reset();
+    } else {
+        auto overlay = std::make_unique<BlurDebugOverlay>();
+        if (!overlay->isValid()) {
+            return;
+        }
+        m_debugOverlay = std::move(overlay);
+    }
+    effects->addRepaintFull();
 }
 
-void BlurEffect::drawWindow(const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w, int mask, const QRegion &region, WindowPaintData &data)
+qint64 BlurEffect::freeIdleRenderTargets(std::chrono::milliseconds idleTime, qint64 budget)
 {
-    auto it = m_windows.find(w);
-    if (it != m_windows.end()) {
-        BlurEffectData &blurInfo = it->second;
-        BlurRenderData &renderInfo = blurInfo.render[m_currentScreen];
-        if (shouldBlur(w, mask, data)) {
-            blur(renderInfo, renderTarget, viewport, w, mask, region, data);
+    const qint64 initialUsage = memoryUsage().total();
+    qint64 usage = initialUsage;
+    if (usage <= budget) {
+        return 0;
+    }
+
+    // The window is nullptr for render data that isn't owned by a window.
+    std::vector<std::pair<BlurRenderData *, EffectWindow *>> candidates;
+    const auto addCandidate = [this, &candidates, idleTime](BlurRenderData &renderInfo, EffectWindow *w) {
+        if (!renderInfo.textures.empty() && m_presentTime - renderInfo.lastUsedTime >= idleTime) {
+            candidates.emplace_back(&renderInfo, w);
+        }
+    };
+    m_records.forEach([&addCandidate](EffectWindow *w, WindowRecord &record) {
+        if (record.blur) {
+            for (auto &[screen, renderInfo] : record.blur->render) {
+                addCandidate(renderInfo, w);
+            }
         }
+    });
+    for (auto &[screen, renderData] : m_batchRender) {
+        addCandidate(renderData.render, nullptr);
     }
+    addCandidate(m_secondaryRender, nullptr);
+    std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) {
+        return a.first->lastUsedTime < b.first->lastUsedTime;
+    });
 
-    // Draw the window over the blurred area
-    effects->drawWindow(renderTarget, viewport, w, mask, region, data);
+    for (const auto &[renderInfo, w] : candidates) {
+        if (usage <= budget) {
+            break;
+        }
+        for (const auto &texture : renderInfo->textures) {
+            usage -= textureBytes(texture.get());
+        }
+        renderInfo->framebuffers.clear();
+        renderInfo->textures.clear();
+        renderInfo->blurredArea = QRegion();
+
+        // The background has to be fetched again as far as the blur samples it.
+        if (w) {
+            effects->addRepaint(expandedRegion(blurRegion(w).translated(w->pos().toPoint()), m_expandSize));
+        }
+    }
+
+    // Batches whose render targets were freed have to fetch their whole background again.
+    for (auto &[screen, renderData] : m_batchRender) {
+        if (renderData.render.textures.empty()) {
+            renderData.batch.reset();
+        }
+    }
+    return initialUsage - usage;
+}
+
+void BlurEffect::freeAllTextures()
+{
+    m_records.forEach([](EffectWindow *, WindowRecord &record) {
+        if (record.blur) {
+            record.blur->render.clear();
+        }
+    });
+    m_batchRender.clear();
+    m_secondaryRender = BlurRenderData();
+    m_staticBlurTextures.clear();
+    noiseTexture.reset();
 }
 
-GLTexture *BlurEffect::ensureStaticBlurTexture(const Output *output, const RenderTarget &renderTarget)
+void BlurEffect::freeScreenTextures(Output *screen)
 {
-    if (m_staticBlurTextures.contains(output)) {
-        return m_staticBlurTextures[output].get();
+    m_records.forEach([screen](EffectWindow *, WindowRecord &record) {
+        if (!record.blur) {
+            return;
+        }
+        if (auto it = record.blur->render.find(screen); it != record.blur->render.end()) {
+            effects->makeOpenGLContextCurrent();
+            record.blur->render.erase(it);
+        }
+        record.blur->visibleBlurArea.erase(screen);
+    });
+
+    if (auto it = m_batchRender.find(screen); it != m_batchRender.end()) {
+        effects->makeOpenGLContextCurrent();
+        m_batchRender.erase(it);
     }
 
-    if (effects->waylandDisplay() && !output) {
-        return nullptr;
+    // The texture is destroyed once no other output uses it.
+    if (auto it = m_staticBlurTextures.find(screen); it != m_staticBlurTextures.end()) {
+        effects->makeOpenGLContextCurrent();
+        m_staticBlurTextures.erase(it);
     }
+}
 
-    GLenum textureFormat = GL_RGBA8;
-    if (renderTarget.texture()) {
-        textureFormat = renderTarget.texture()->internalFormat();
+bool BlurEffect::updateFullScreenPause(Output *screen)
+{
+    // On X11, all screens are painted at once.
+    const EffectWindow *fullScreenWindow = screen && m_settings.general.pauseOnFullScreen ? unobstructedFullScreenWindow(screen) : nullptr;
+    if (!fullScreenWindow) {
+        m_fullScreenPauses.erase(screen);
+        return false;
     }
-    GLTexture *texture = effects->waylandDisplay()
-        ? createStaticBlurTextureWayland(output, renderTarget, textureFormat)
-        : createStaticBlurTextureX11(textureFormat);
-    if (!texture) {
-        return nullptr;
+
+    if (!m_fullScreenPauses.contains(screen)) {
+        m_fullScreenPauses[screen].since = std::chrono::steady_clock::now();
+        if (!m_fullScreenPauseTimer.isActive()) {
+            m_fullScreenPauseTimer.start(s_fullScreenPauseDelay);
+        }
     }
+    m_fullScreenPauses[screen].window = fullScreenWindow;
+    return true;
+}
 
-    return (m_staticBlurTextures[output] = std::unique_ptr<GLTexture>(texture)).get();
+void BlurEffect::resumeFullScreenPause()
+{
+    m_fullScreenPauses.erase(m_currentScreen);
+    m_frame->paused = false;
+
+    // The windows behind were prepared without blur. Their opaque regions are outdated, so they're blurred in their
+    // entirety in this frame, and their bookkeeping is redone in the next one.
+    m_records.forEach([](EffectWindow *, WindowRecord &record) {
+        if (record.blur) {
+            record.blur->opaque = QRegion();
+        }
+    });
+    repaintBlurArea(m_currentScreen);
 }
 
-GLTexture *BlurEffect::ensureNoiseTexture()
+const EffectWindow *BlurEffect::unobstructedFullScreenWindow(const Output *screen) const
 {
-    if (m_settings.general.noiseStrength == 0) {
+    const QRect geometry = screen->geometry();
+
+    const EffectWindow *topmost = nullptr;
+    const WindowRecord *topmostRecord = nullptr;
+    m_records.forEach([&geometry, &topmost, &topmostRecord](EffectWindow *w, const WindowRecord &record) {
+        if (!w->isOnCurrentDesktop()
+            || !w->isOnCurrentActivity()
+            || w->isMinimized()
+            || w->window()->resourceClass() == "xwaylandvideobridge"
+            || !w->frameGeometry().toRect().intersects(geometry)) {
+            return;
+        }
+        if (!topmost || w->window()->stackingOrder() > topmost->window()->stackingOrder()) {
+            topmost = w;
+            topmostRecord = &record;
+        }
+    });
+
+    // The opaque region is empty if the window was transformed or translucent.
+    if (!topmost || !topmost->isFullScreen() || topmost->opacity() < 1 || !(QRegion(geometry) - topmostRecord->lastOpaque).isEmpty()) {
         return nullptr;
     }
+    return topmost;
+}
 
-    const qreal scale = std::max(1.0, QGuiApplication::primaryScreen()->logicalDotsPerInch() / 96.0);
-    if (!noiseTexture || noiseTextureScale != scale || noiseTextureStength != m_settings.general.noiseStrength) {
-        // Init randomness based on time
-        std::srand((uint)QTime::currentTime().msec());
-
-        QImage noiseImage(QSize(256, 256), QImage::Format_Grayscale8);
-
-        for (int y = 0; y < noiseImage.height(); y++) {
-            uint8_t *noiseImageLine = (uint8_t *)noiseImage.scanLine(y);
+void BlurEffect::freePausedScreenTextures()
+{
+    const auto now = std::chrono::steady_clock::now();
+    std::optional<std::chrono::milliseconds> nextDelay;
+    for (auto &[screen, pause] : m_fullScreenPauses) {
+        if (pause.texturesFreed) {
+            continue;
+        }
 
-            for (int x = 0; x < noiseImage.width(); x++) {
-                noiseImageLine[x] = std::rand() % m_settings.general.noiseStrength;
-            }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - pause.since);
+        if (elapsed >= s_fullScreenPauseDelay) {
+            freeScreenTextures(screen);
+            pause.texturesFreed = true;
+        } else {
+            nextDelay = std::min(nextDelay.value_or(s_fullScreenPauseDelay), s_fullScreenPauseDelay - elapsed);
         }
+    }
 
-        noiseImage = noiseImage.scaled(noiseImage.size() * scale);
+    if (nextDelay) {
+        m_fullScreenPauseTimer.start(*nextDelay);
+    }
+}
 
-        noiseTexture = GLTexture::upload(noiseImage);
-        if (!noiseTexture) {
-            return nullptr;
-        }
-        noiseTexture->setFilter(GL_NEAREST);
-        noiseTexture->setWrapMode(GL_REPEAT);
-        noiseTextureScale = scale;
-        noiseTextureStength = m_settings.general.noiseStrength;
+void BlurEffect::reduceStrength()
+{
+    if (!m_engine || m_strength == 0) {
+        return;
     }
 
-    return noiseTexture.get();
+    // The expand size may shrink, the area sampled with the current one needs to be repainted.
+    repaintBlurArea();
+
+    m_strength--;
+    m_engine->setStrength(m_strength);
+    m_expandSize = m_engine->expandSize();
+    qCWarning(KWIN_BLUR) << "Reducing the blur strength to" << m_strength << "because render targets couldn't be allocated";
 }
 
-void BlurEffect::blur(BlurRenderData &renderInfo, const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w, int mask, const QRegion &region, WindowPaintData &data)
+void BlurEffect::blur(BlurRenderData &renderInfo, const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w, int mask, const QRegion &region, WindowPaintData &data, BlurPass pass)
 {
     // Compute the effective blur shape. Note that if the window is transformed, so will be the blur shape.
     QRegion blurShape = w ? blurRegion(w).translated(w->pos().toPoint()) : region;
+    const bool transformed = data.xScale() != 1 || data.yScale() != 1 || data.xTranslation() || data.yTranslation();
     if (data.xScale() != 1 || data.yScale() != 1) {
         QPoint pt = blurShape.boundingRect().topLeft();
         QRegion scaledShape;
@@ -779,46 +2452,53 @@ void BlurEffect::blur(BlurRenderData &renderInfo, const RenderTarget &renderTarg
         ? w->opacity() * data.opacity()
         : data.opacity();
 
-    QList<QRectF> effectiveShape;
-    effectiveShape.reserve(blurShape.rectCount());
-    if (region != infiniteRegion()) {
-        for (const QRect &clipRect : region) {
-            const QRectF deviceClipRect = snapToPixelGridF(scaledRect(clipRect, viewport.scale()))
-                    .translated(-deviceBackgroundRect.topLeft());
-            for (const QRect &shapeRect : blurShape) {
-                const QRectF deviceShapeRect = snapToPixelGridF(scaledRect(shapeRect.translated(-backgroundRect.topLeft()), viewport.scale()));
-                if (const QRectF intersected = deviceClipRect.intersected(deviceShapeRect); !intersected.isEmpty()) {
-                    effectiveShape.append(intersected);
-                }
+    // Split the shape into the part that is painted using the static blur texture and the part that has windows
+    // behind it and needs to be actually blurred. Transformed windows can't be split, as the region occupied by the
+    // windows behind is not transformed.
+    // Since the VBO is shared, the static texture needs to be created before the geometry is uploaded, otherwise it
+    // will be reset.
+    QRegion staticShape;
+    StaticBlurTexture *staticBlurTexture = nullptr;
+    if (w && pass == BlurPass::Screen && hasStaticBlur(w)) {
+        QRegion windowsBehind;
+        if (const BlurEffectData *blurInfo = blurData(w)) {
+            windowsBehind = blurInfo->windowsBehind;
+        }
+
+        if (windowsBehind.isEmpty()) {
+            staticShape = blurShape;
+        } else if (!transformed) {
+            staticShape = blurShape - windowsBehind;
+        }
+
+        if (!staticShape.isEmpty()) {
+            staticBlurTexture = ensureTextureShader() ? ensureStaticBlurTexture(m_currentScreen, renderTarget) : nullptr;
+            if (!staticBlurTexture) {
+                staticShape = QRegion();
             }
         }
-    } else {
-        for (const QRect &rect : blurShape) {
-            effectiveShape.append(snapToPixelGridF(scaledRect(rect.translated(-backgroundRect.topLeft()), viewport.scale())));
+    } else if (w && (pass == BlurPass::Static || (pass == BlurPass::Full && hasStaticBlur(w))) && ensureTextureShader()) {
+        // The texture is only created for the screen, since it depends on the format of the render target.
+        if (auto it = m_staticBlurTextures.find(m_currentScreen); it != m_staticBlurTextures.end()) {
+            staticShape = blurShape;
+            staticBlurTexture = it->second.get();
         }
     }
-    if (effectiveShape.isEmpty()) {
-        return;
+    // Nothing can be blurred if no engine could be created. The parts hidden behind opaque windows above are neither
+    // fetched nor processed.
+    QRegion realShape = m_engine ? blurShape - staticShape : QRegion();
+    if (w && !transformed && pass == BlurPass::Screen) {
+        realShape -= occludedBlurArea(w);
     }
 
-    float topCornerRadius = 0;
-    float bottomCornerRadius = 0;
-    if (w && !(w->isDock() && !isDockFloating(w, blurShape))) {
-        const bool isMaximized = effects->clientArea(MaximizeArea, effects->activeScreen(), effects->currentDesktop()) == w->frameGeometry();
-        if (isMenu(w)) {
-            topCornerRadius = bottomCornerRadius = m_settings.roundedCorners.menuRadius;
-        } else if (w->isDock()) {
-            topCornerRadius = bottomCornerRadius = m_settings.roundedCorners.dockRadius;
-        } else if ((!w->isFullScreen() && !isMaximized) || m_settings.roundedCorners.roundMaximized) {
-            if (!w->decoration() || (w->decoration() && m_settings.forceBlur.blurDecorations)) {
-                topCornerRadius = m_settings.roundedCorners.windowTopRadius;
-            }
-            bottomCornerRadius = m_settings.roundedCorners.windowBottomRadius;
-        }
-        topCornerRadius = topCornerRadius * viewport.scale();
-        bottomCornerRadius = bottomCornerRadius * viewport.scale();
+    const QList<QRectF> staticEffectiveShape = effectiveShape(staticShape, region, viewport, backgroundRect, deviceBackgroundRect);
+    const QList<QRectF> realEffectiveShape = effectiveShape(realShape, region, viewport, backgroundRect, deviceBackgroundRect);
+    if (staticEffectiveShape.isEmpty() && realEffectiveShape.isEmpty()) {
+        return;
     }
 
+    const auto [topCornerRadius, bottomCornerRadius] = cornerRadii(w, blurShape, viewport);
+
     // Maybe reallocate offscreen render targets. Keep in mind that the first one contains
     // original background behind the window, it's not blurred.
     GLenum textureFormat = GL_RGBA8;
@@ -826,145 +2506,54 @@ void BlurEffect::blur(BlurRenderData &renderInfo, const RenderTarget &renderTarg
         textureFormat = renderTarget.texture()->internalFormat();
     }
 
-    // Since the VBO is shared, the texture needs to be blurred before the geometry is uploaded, otherwise it will be
-    // reset.
-    GLTexture *staticBlurTexture = nullptr;
-    if (w && hasStaticBlur(w)) {
-        staticBlurTexture = ensureStaticBlurTexture(m_currentScreen, renderTarget);
-        if (staticBlurTexture) {
-            renderInfo.textures.clear();
-            renderInfo.framebuffers.clear();
-        }
-    }
-
-    if (!staticBlurTexture
-        && (renderInfo.framebuffers.size() != (m_iterationCount + 1)
-            || renderInfo.textures[0]->size() != backgroundRect.size()
-            || renderInfo.textures[0]->internalFormat() != textureFormat)) {
-        renderInfo.framebuffers.clear();
+    if (pass == BlurPass::ReuseScreen) {
+        // The render targets already contain the blurred background.
+    } else if (realShape.isEmpty()) {
         renderInfo.textures.clear();
-
-        for (size_t i = 0; i <= m_iterationCount; ++i) {
-            auto texture = GLTexture::allocate(textureFormat, backgroundRect.size() / (1 << i));
-            if (!texture) {
-                qCWarning(KWIN_BLUR) << "Failed to allocate an offscreen texture";
-                return;
-            }
-            texture->setFilter(GL_LINEAR);
-            texture->setWrapMode(GL_CLAMP_TO_EDGE);
-
-            auto framebuffer = std::make_unique<GLFramebuffer>(texture.get());
-            if (!framebuffer->valid()) {
-                qCWarning(KWIN_BLUR) << "Failed to create an offscreen framebuffer";
-                return;
-            }
-            renderInfo.textures.push_back(std::move(texture));
-            renderInfo.framebuffers.push_back(std::move(framebuffer));
-        }
+        renderInfo.framebuffers.clear();
+    } else if (!ensureRenderTargets(renderInfo, m_engine->renderTargets(backgroundRect.size()), textureFormat)) {
+        return;
     }
 
-    // Fetch the pixels behind the shape that is going to be blurred.
-    if (!staticBlurTexture) {
-        const QRegion dirtyRegion = region & backgroundRect;
+    // Only the part of the background around the actually blurred shape is processed. Pixels outside of it are only
+    // sampled near its edges, which are never painted on the screen.
+    const QRect processingRect = realShape.boundingRect().adjusted(-m_expandSize, -m_expandSize, m_expandSize, m_expandSize) & backgroundRect;
+
+    // Fetch the pixels behind the shape that is going to be blurred. Render targets used outside of the screen are
+    // shared by all windows, the whole background is fetched.
+    if (!realShape.isEmpty() && pass != BlurPass::ReuseScreen) {
+        const QRegion dirtyRegion = pass == BlurPass::Screen ? region & processingRect : QRegion(processingRect);
         for (const QRect &dirtyRect: dirtyRegion) {
             renderInfo.framebuffers[0]->blitFromRenderTarget(renderTarget, viewport, dirtyRect, dirtyRect.translated(-backgroundRect.topLeft()));
         }
+
+        if (w && pass == BlurPass::Screen) {
+            updateBatchBackground(renderTarget, viewport, w);
+        }
     }
 
     // Upload the geometry: the first 6 vertices are used when downsampling and upsampling offscreen,
-    // the remaining vertices are used when rendering on the screen.
+    // the remaining vertices are used when rendering on the screen, first the static part, then the blurred part.
     GLVertexBuffer *vbo = GLVertexBuffer::streamingBuffer();
     vbo->reset();
     vbo->setAttribLayout(std::span(GLVertexBuffer::GLVertex2DLayout), sizeof(GLVertex2D));
 
-    const int vertexCount = effectiveShape.size() * 6;
-    if (auto result = vbo->map<GLVertex2D>(6 + vertexCount)) {
+    const int staticVertexCount = staticEffectiveShape.size() * 6;
+    const int realVertexCount = realEffectiveShape.size() * 6;
+    if (auto result = vbo->map<GLVertex2D>(6 + staticVertexCount + realVertexCount)) {
         auto map = *result;
 
         size_t vboIndex = 0;
 
         // The geometry that will be blurred offscreen, in logical pixels.
-        {
-            const QRectF localRect = QRectF(0, 0, backgroundRect.width(), backgroundRect.height());
-
-            const float x0 = localRect.left();
-            const float y0 = localRect.top();
-            const float x1 = localRect.right();
-            const float y1 = localRect.bottom();
-
-            const float u0 = x0 / backgroundRect.width();
-            const float v0 = 1.0f - y0 / backgroundRect.height();
-            const float u1 = x1 / backgroundRect.width();
-            const float v1 = 1.0f - y1 / backgroundRect.height();
-
-            // first triangle
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x0, y0),
-                .texcoord = QVector2D(u0, v0),
-            };
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x1, y1),
-                .texcoord = QVector2D(u1, v1),
-            };
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x0, y1),
-                .texcoord = QVector2D(u0, v1),
-            };
-
-            // second triangle
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x0, y0),
-                .texcoord = QVector2D(u0, v0),
-            };
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x1, y0),
-                .texcoord = QVector2D(u1, v0),
-            };
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x1, y1),
-                .texcoord = QVector2D(u1, v1),
-            };
-        }
+        addQuad(map, vboIndex, QRectF(processingRect.translated(-backgroundRect.topLeft())), backgroundRect.size());
 
         // The geometry that will be painted on screen, in device pixels.
-        for (const QRectF &rect : effectiveShape) {
-            const float x0 = rect.left();
-            const float y0 = rect.top();
-            const float x1 = rect.right();
-            const float y1 = rect.bottom();
-
-            const float u0 = x0 / deviceBackgroundRect.width();
-            const float v0 = 1.0f - y0 / deviceBackgroundRect.height();
-            const float u1 = x1 / deviceBackgroundRect.width();
-            const float v1 = 1.0f - y1 / deviceBackgroundRect.height();
-
-            // first triangle
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x0, y0),
-                .texcoord = QVector2D(u0, v0),
-            };
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x1, y1),
-                .texcoord = QVector2D(u1, v1),
-            };
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x0, y1),
-                .texcoord = QVector2D(u0, v1),
-            };
-
-            // second triangle
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x0, y0),
-                .texcoord = QVector2D(u0, v0),
-            };
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x1, y0),
-                .texcoord = QVector2D(u1, v0),
-            };
-            map[vboIndex++] = GLVertex2D{
-                .position = QVector2D(x1, y1),
-                .texcoord = QVector2D(u1, v1),
-            };
+        for (const QRectF &rect : staticEffectiveShape) {
+            addQuad(map, vboIndex, rect, deviceBackgroundRect.size());
+        }
+        for (const QRectF &rect : realEffectiveShape) {
+            addQuad(map, vboIndex, rect, deviceBackgroundRect.size());
         }
 
         vbo->unmap();
@@ -975,8 +2564,11 @@ void BlurEffect::blur(BlurRenderData &renderInfo, const RenderTarget &renderTarg
 
     vbo->bindArrays();
 
-    if (staticBlurTexture) {
-        ShaderManager::instance()->pushShader(m_texture.shader.get());
+    if (!staticEffectiveShape.isEmpty()) {
+        // The program isn't managed by ShaderManager, so the bound program has to be restored manually.
+        GLint previousProgram = 0;
+        glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+        glUseProgram(m_texture.program);
 
         QMatrix4x4 projectionMatrix;
         projectionMatrix = viewport.projectionMatrix();
@@ -987,127 +2579,69 @@ void BlurEffect::blur(BlurRenderData &renderInfo, const RenderTarget &renderTarg
             screenGeometry = m_currentScreen->geometryF();
         }
 
-        m_texture.shader->setUniform(m_texture.mvpMatrixLocation, projectionMatrix);
-        m_texture.shader->setUniform(m_texture.textureSizeLocation, QVector2D(staticBlurTexture->size().width(), staticBlurTexture->size().height()));
-        m_texture.shader->setUniform(m_texture.texStartPosLocation, QVector2D(backgroundRect.x() - screenGeometry.x(), backgroundRect.y() - screenGeometry.y()));
-        m_texture.shader->setUniform(m_texture.blurSizeLocation, QVector2D(backgroundRect.width(), backgroundRect.height()));
-        m_texture.shader->setUniform(m_texture.scaleLocation, (float)viewport.scale());
-        m_texture.shader->setUniform(m_texture.topCornerRadiusLocation, topCornerRadius);
-        m_texture.shader->setUniform(m_texture.bottomCornerRadiusLocation, bottomCornerRadius);
-        m_texture.shader->setUniform(m_texture.antialiasingLocation, m_settings.roundedCorners.antialiasing);
-        m_texture.shader->setUniform(m_texture.opacityLocation, static_cast<float>(opacity));
-
-        staticBlurTexture->bind();
+        glUniformMatrix4fv(m_texture.mvpMatrixLocation, 1, GL_FALSE, projectionMatrix.constData());
+        glUniform2f(m_texture.textureSizeLocation, staticBlurTexture->size.width(), staticBlurTexture->size.height());
+        glUniform2f(m_texture.texStartPosLocation, backgroundRect.x() - screenGeometry.x(), backgroundRect.y() - screenGeometry.y());
+        glUniform2f(m_texture.blurSizeLocation, backgroundRect.width(), backgroundRect.height());
+        glUniform1f(m_texture.scaleLocation, viewport.scale());
+        glUniform1f(m_texture.topCornerRadiusLocation, topCornerRadius);
+        glUniform1f(m_texture.bottomCornerRadiusLocation, bottomCornerRadius);
+        glUniform1f(m_texture.antialiasingLocation, m_settings.roundedCorners.antialiasing);
+        glUniform1f(m_texture.opacityLocation, opacity);
+
+        staticBlurTexture->texture->bind();
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-        vbo->draw(GL_TRIANGLES, 6, vertexCount);
+        vbo->draw(GL_TRIANGLES, 6, staticVertexCount);
 
         glDisable(GL_BLEND);
-        ShaderManager::instance()->popShader();
-    }
-    else {
-        // The downsample pass of the dual Kawase algorithm: the background will be scaled down 50% every iteration.
-        {
-            ShaderManager::instance()->pushShader(m_downsamplePass.shader.get());
-
-            QMatrix4x4 projectionMatrix;
-            projectionMatrix.ortho(QRectF(0.0, 0.0, backgroundRect.width(), backgroundRect.height()));
-
-            m_downsamplePass.shader->setUniform(m_downsamplePass.mvpMatrixLocation, projectionMatrix);
-            m_downsamplePass.shader->setUniform(m_downsamplePass.offsetLocation, float(m_offset));
-            m_downsamplePass.shader->setUniform(m_downsamplePass.colorMatrixLocation, m_colorMatrix);
-            m_downsamplePass.shader->setUniform(m_downsamplePass.transformColorsLocation, true);
-
-            for (size_t i = 1; i < renderInfo.framebuffers.size(); ++i) {
-                const auto &read = renderInfo.framebuffers[i - 1];
-                const auto &draw = renderInfo.framebuffers[i];
-
-                const QVector2D halfpixel(0.5 / read->colorAttachment()->width(),
-                                          0.5 / read->colorAttachment()->height());
-                m_downsamplePass.shader->setUniform(m_downsamplePass.halfpixelLocation, halfpixel);
-
-                read->colorAttachment()->bind();
-
-                GLFramebuffer::pushFramebuffer(draw.get());
-                vbo->draw(GL_TRIANGLES, 0, 6);
-
-                if (i == 1) {
-                    m_downsamplePass.shader->setUniform(m_downsamplePass.transformColorsLocation, false);
-                }
-            }
-
-            ShaderManager::instance()->popShader();
-        }
-
-        // The upsample pass of the dual Kawase algorithm: the background will be scaled up 200% every iteration.
-        ShaderManager::instance()->pushShader(m_upsamplePass.shader.get());
-
-        QMatrix4x4 projectionMatrix;
-        projectionMatrix.ortho(QRectF(0.0, 0.0, backgroundRect.width(), backgroundRect.height()));
-
-        m_upsamplePass.shader->setUniform(m_upsamplePass.topCornerRadiusLocation, static_cast<float>(0));
-        m_upsamplePass.shader->setUniform(m_upsamplePass.bottomCornerRadiusLocation, static_cast<float>(0));
-        m_upsamplePass.shader->setUniform(m_upsamplePass.mvpMatrixLocation, projectionMatrix);
-        m_upsamplePass.shader->setUniform(m_upsamplePass.noiseLocation, false);
-        m_upsamplePass.shader->setUniform(m_upsamplePass.offsetLocation, float(m_offset));
-
-        for (size_t i = renderInfo.framebuffers.size() - 1; i > 1; --i) {
-            GLFramebuffer::popFramebuffer();
-            const auto &read = renderInfo.framebuffers[i];
-
-            const QVector2D halfpixel(0.5 / read->colorAttachment()->width(),
-                                      0.5 / read->colorAttachment()->height());
-            m_upsamplePass.shader->setUniform(m_upsamplePass.halfpixelLocation, halfpixel);
-
-            read->colorAttachment()->bind();
-
-            vbo->draw(GL_TRIANGLES, 0, 6);
+        glUseProgram(previousProgram);
+    }
+
+    bool blurred = false;
+    if (!realEffectiveShape.isEmpty()) {
+        if (pass == BlurPass::ReuseScreen) {
+            // Drawn as it was blurred for the screen.
+        } else if (pass != BlurPass::Screen || transformed || !canReuseBlur(renderInfo, processingRect)) {
+            m_engine->blur(renderInfo, vbo, 6, processingRect.translated(-backgroundRect.topLeft()), backgroundRect.size(), m_colorMatrix);
+            renderInfo.blurredArea = processingRect;
+            renderInfo.blurTime = m_presentTime;
+            renderInfo.lastUsedTime = m_presentTime;
+            blurred = true;
+        } else {
+            // The background may have changed, the blur is updated once the limit allows it.
+            effects->addRepaint(realShape);
         }
 
-        // The last upsampling pass is rendered on the screen, not in framebuffers[0].
-        GLFramebuffer::popFramebuffer();
-        const auto &read = renderInfo.framebuffers[1];
-
+        BlurDrawParameters parameters;
+        parameters.projectionMatrix = viewport.projectionMatrix();
+        parameters.projectionMatrix.translate(deviceBackgroundRect.x(), deviceBackgroundRect.y());
+        parameters.blurSize = backgroundRect.size();
+        parameters.scale = viewport.scale();
+        parameters.topCornerRadius = topCornerRadius;
+        parameters.bottomCornerRadius = bottomCornerRadius;
+        parameters.antialiasing = m_settings.roundedCorners.antialiasing;
+        parameters.opacity = opacity;
         if (m_settings.general.noiseStrength > 0) {
-            if (auto *noiseTexture = ensureNoiseTexture()) {
-                m_upsamplePass.shader->setUniform(m_upsamplePass.noiseLocation, true);
-                m_upsamplePass.shader->setUniform(m_upsamplePass.noiseTextureSizeLocation, QVector2D(noiseTexture->width(), noiseTexture->height()));
-
-                glUniform1i(m_upsamplePass.noiseTextureLocation, 1);
-                glActiveTexture(GL_TEXTURE1);
-                noiseTexture->bind();
-            }
+            parameters.noiseTexture = ensureNoiseTexture();
         }
 
-        glUniform1i(m_upsamplePass.textureLocation, 0);
-        glActiveTexture(GL_TEXTURE0);
-        read->colorAttachment()->bind();
-
-        m_upsamplePass.shader->setUniform(m_upsamplePass.topCornerRadiusLocation, topCornerRadius);
-        m_upsamplePass.shader->setUniform(m_upsamplePass.bottomCornerRadiusLocation, bottomCornerRadius);
-        m_upsamplePass.shader->setUniform(m_upsamplePass.antialiasingLocation, m_settings.roundedCorners.antialiasing);
-        m_upsamplePass.shader->setUniform(m_upsamplePass.blurSizeLocation, QVector2D(backgroundRect.width(), backgroundRect.height()));
-        m_upsamplePass.shader->setUniform(m_upsamplePass.opacityLocation, static_cast<float>(opacity));
-
-        projectionMatrix = viewport.projectionMatrix();
-        projectionMatrix.translate(deviceBackgroundRect.x(), deviceBackgroundRect.y());
-        m_upsamplePass.shader->setUniform(m_upsamplePass.mvpMatrixLocation, projectionMatrix);
-
-        const QVector2D halfpixel(0.5 / read->colorAttachment()->width(),
-                                  0.5 / read->colorAttachment()->height());
-        m_upsamplePass.shader->setUniform(m_upsamplePass.halfpixelLocation, halfpixel);
-
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-        vbo->draw(GL_TRIANGLES, 6, vertexCount);
-
-        glDisable(GL_BLEND);
-        ShaderManager::instance()->popShader();
+        m_engine->draw(renderInfo, vbo, 6 + staticVertexCount, realVertexCount, parameters);
     }
 
     vbo->unbindArrays();
+
+    if (m_debugOverlay && w && pass == BlurPass::Screen) {
+        BlurDebugWindow &debugInfo = m_debugOverlay->window(w);
+        debugInfo.staticArea = staticShape & region;
+        (blurred ? debugInfo.blurredArea : debugInfo.reusedArea) = realShape & region;
+        debugInfo.occludedArea = transformed ? QRegion() : blurShape & occludedBlurArea(w) & region;
+        debugInfo.backgroundRect = realShape.isEmpty() ? QRect() : processingRect;
+        debugInfo.passes = (staticEffectiveShape.isEmpty() ? 0 : 1)
+            + (realEffectiveShape.isEmpty() ? 0 : 1)
+            + (blurred ? m_engine->blurPassCount() : 0);
+    }
 }
 
 void BlurEffect::blur(GLTexture *texture)
@@ -1157,7 +2691,7 @@ GLTexture *BlurEffect::wallpaper(EffectWindow *desktop, const qreal &scale, cons
     return texture.release();
 }
 
-GLTexture *BlurEffect::createStaticBlurTextureWayland(const Output *output, const RenderTarget &renderTarget, const GLenum &textureFormat)
+std::unique_ptr<GLTexture> BlurEffect::staticBlurSourceTexture(const Output *output, const GLenum &textureFormat)
 {
     EffectWindow *desktop = nullptr;
     for (EffectWindow *w : effects->stackingOrder()) {
@@ -1170,12 +2704,20 @@ GLTexture *BlurEffect::createStaticBlurTextureWayland(const Output *output, cons
         return nullptr;
     }
 
-    std::unique_ptr<GLTexture> texture;
     if (m_settings.staticBlur.imageSource == StaticBlurImageSource::DesktopWallpaper) {
-        texture.reset(wallpaper(desktop, output->scale(), textureFormat));
-    } else if (m_settings.staticBlur.imageSource == StaticBlurImageSource::Custom) {
-        texture = GLTexture::upload(m_settings.staticBlur.customImage.scaled(output->pixelSize(), Qt::AspectRatioMode::IgnoreAspectRatio, Qt::TransformationMode::SmoothTransformation));
+        return std::unique_ptr<GLTexture>(wallpaper(desktop, output->scale(), textureFormat));
+    }
+
+    // The image is scaled in the background, real blur is used until it's ready.
+    const QImage image = m_imageLoader.image(output->pixelSize());
+    if (image.isNull()) {
+        return nullptr;
     }
+    return GLTexture::upload(image);
+}
+
+GLTexture *BlurEffect::createStaticBlurTextureWayland(std::unique_ptr<GLTexture> texture, const RenderTarget &renderTarget, const GLenum &textureFormat)
+{
     if (!texture) {
         return nullptr;
     }
@@ -1209,7 +2751,11 @@ GLTexture *BlurEffect::createStaticBlurTextureWayland(const Output *output, cons
     GLFramebuffer::popFramebuffer();
     ShaderManager::instance()->popShader();
 
-    if (m_settings.staticBlur.blurCustomImage) {
+    // Custom images may already have been blurred by the image loader, which leaves the color matrix to be applied
+    // in the color space of the render target, like in the first downsample pass.
+    if (m_settings.staticBlur.blurCustomImage && m_settings.staticBlur.imageSource == StaticBlurImageSource::Custom && m_imageLoader.blursImages()) {
+        applyColorMatrix(texture, textureFormat);
+    } else if (m_settings.staticBlur.blurCustomImage) {
         blur(texture.get());
     }
 
@@ -1228,6 +2774,18 @@ GLTexture *BlurEffect::createStaticBlurTextureX11(const GLenum &textureFormat)
         desktopGeometries += w->frameGeometry().toRect();
     }
 
+    // Request the images for all desktops first, so that they're scaled in parallel. Real blur is used until all of
+    // them are ready.
+    if (m_settings.staticBlur.imageSource == StaticBlurImageSource::Custom) {
+        bool ready = true;
+        for (auto *desktop : desktops) {
+            ready &= !m_imageLoader.image(desktop->frameGeometry().size().toSize()).isNull();
+        }
+        if (!ready) {
+            return nullptr;
+        }
+    }
+
     auto compositeTexture = GLTexture::allocate(textureFormat, desktopGeometries.boundingRect().size());
     if (!compositeTexture) {
         return nullptr;
@@ -1246,13 +2804,15 @@ GLTexture *BlurEffect::createStaticBlurTextureX11(const GLenum &textureFormat)
         if (m_settings.staticBlur.imageSource == StaticBlurImageSource::DesktopWallpaper) {
             texture.reset(wallpaper(desktop, 1, textureFormat));
         } else if (m_settings.staticBlur.imageSource == StaticBlurImageSource::Custom) {
-            texture = GLTexture::upload(m_settings.staticBlur.customImage.scaled(geometry.width(), geometry.height(), Qt::AspectRatioMode::IgnoreAspectRatio, Qt::TransformationMode::SmoothTransformation));
+            texture = GLTexture::upload(m_imageLoader.image(geometry.size().toSize()));
         }
         if (!texture) {
             return nullptr;
         }
 
-        if (m_settings.staticBlur.blurCustomImage) {
+        if (m_settings.staticBlur.blurCustomImage && m_settings.staticBlur.imageSource == StaticBlurImageSource::Custom && m_imageLoader.blursImages()) {
+            applyColorMatrix(texture, textureFormat);
+        } else if (m_settings.staticBlur.blurCustomImage) {
             blur(texture.get());
         }
 
@@ -13,11 +13,21 @@
 #include "scene/item.h"
 #endif
 
+#include "blurdebugoverlay.h"
+#include "blurengine.h"
+#include "blurstatistics.h"
 #include "settings.h"
+#include "staticblurcache.h"
+#include "staticblurimageloader.h"
 #include "window.h"
+#include "windowrecordstore.h"
 
 #include <QList>
+#include <QSet>
+#include <QTimer>
 
+#include <chrono>
+#include <optional>
 #include <unordered_map>
 
 
@@ -26,12 +36,34 @@ namespace KWin
 
 class BlurManagerInterface;
 
-struct BlurRenderData
+struct StaticBlurTexture
 {
-    /// Temporary render targets needed for the Dual Kawase algorithm, the first texture
-    /// contains not blurred background behind the window, it's cached.
-    std::vector<std::unique_ptr<GLTexture>> textures;
-    std::vector<std::unique_ptr<GLFramebuffer>> framebuffers;
+    /// May be stored at a lower resolution and in a more compact format than the render target.
+    std::unique_ptr<GLTexture> texture;
+
+    /// The size of the image before it was scaled down, used for mapping screen coordinates to the texture.
+    QSize size;
+
+    /// Identifies the source image and all parameters the texture was created with. Outputs with identical keys and
+    /// color descriptions share the texture. Empty if the source image couldn't be identified.
+    QByteArray key;
+    std::optional<ColorDescription> colorDescription;
+};
+
+/**
+ * The amount of GPU memory used by the effect, in bytes.
+ */
+struct BlurMemoryUsage
+{
+    qint64 renderTargets = 0;
+    qint64 batchRenderTargets = 0;
+    qint64 staticBlurTextures = 0;
+    qint64 noiseTexture = 0;
+
+    qint64 total() const
+    {
+        return renderTargets + batchRenderTargets + staticBlurTextures + noiseTexture;
+    }
 };
 
 struct BlurEffectData
@@ -49,7 +81,69 @@ struct BlurEffectData
     ItemEffect windowEffect;
 #endif
 
-    bool hasWindowBehind;
+    /// The part of the blur region that overlaps other windows behind this one, in global coordinates. If static
+    /// blur is enabled, only this part is actually blurred.
+    QRegion windowsBehind;
+
+    /// The part of the blur region behind the opaque content of the window in the current frame, in global
+    /// coordinates. Not blurred, since it isn't visible.
+    QRegion opaque;
+
+    /// The part of the blur region that was visible the last time the window was painted on each screen, in global
+    /// coordinates. The background is only fetched where the blur is visible.
+    std::unordered_map<Output *, QRegion> visibleBlurArea;
+};
+
+/**
+ * Everything stored about a window, whether it's blurred or not.
+ */
+struct WindowRecord
+{
+    /// Set if the window has a blur region.
+    std::optional<BlurEffectData> blur;
+
+    /// The opaque region of the window the last time it was painted untransformed, in global coordinates. Used for
+    /// predicting occlusion.
+    QRegion lastOpaque;
+
+    /// Whether the window is blurred even when transformed, see BlurEffect::shouldBlur().
+    bool blurWhenTransformed = false;
+
+    /// The blur region set through the X11 property, std::nullopt if the window doesn't have the property. Only valid
+    /// if x11BlurRegionFetched is set, which is cleared when the property changes.
+    std::optional<QRegion> x11BlurRegion;
+    bool x11BlurRegionFetched = false;
+
+    QMetaObject::Connection blurChangedConnection;
+    QMetaObject::Connection frameGeometryChangedConnection;
+};
+
+/**
+ * Blurred windows that are drawn directly after each other, none of which is drawn over the background of a window
+ * above it. Their backgrounds are fetched into one texture covering the area around all of their shapes and blurred
+ * together when the first one of them is drawn.
+ */
+struct BlurBatch
+{
+    /// In the order the windows are drawn.
+    QList<EffectWindow *> windows;
+
+    /// The blur shapes of the windows, in global logical coordinates.
+    QList<QRegion> shapes;
+
+    bool operator==(const BlurBatch &other) const = default;
+};
+
+struct BlurBatchRenderData
+{
+    BlurRenderData render;
+
+    /// The area of the screen covered by the render targets, in global logical coordinates.
+    QRect backgroundRect;
+
+    /// The batch whose background is up to date. The background is only fetched where the screen is repainted, so it
+    /// can't be reused if the windows or their shapes changed.
+    std::optional<BlurBatch> batch;
 };
 
 class BlurEffect : public KWin::Effect
@@ -66,6 +160,7 @@ public:
     void reconfigure(ReconfigureFlags flags) override;
     void prePaintScreen(ScreenPrePaintData &data, std::chrono::milliseconds presentTime) override;
     void prePaintWindow(EffectWindow *w, WindowPrePaintData &data, std::chrono::milliseconds presentTime) override;
+    void paintScreen(const RenderTarget &renderTarget, const RenderViewport &viewport, int mask, const QRegion &region, Output *screen) override;
     void drawWindow(const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w, int mask, const QRegion &region, WindowPaintData &data) override;
 
     bool provides(Feature feature) override;
@@ -89,28 +184,262 @@ public Q_SLOTS:
     void setupDecorationConnections(EffectWindow *w);
 
 private:
-    void initBlurStrengthValues();
     QRegion blurRegion(EffectWindow *w) const;
+
+    /**
+     * @return The blur regions of all windows, in global logical coordinates.
+     */
+    QRegion blurArea() const;
+
+    /**
+     * Repaints the blurred areas on the screen, including the background they sample. All screens are repainted if
+     * nullptr.
+     */
+    void repaintBlurArea(const Output *screen = nullptr);
     QRegion decorationBlurRegion(const EffectWindow *w) const;
     bool decorationSupportsBlurBehind(const EffectWindow *w) const;
     bool shouldBlur(const EffectWindow *w, int mask, const WindowPaintData &data);
     bool shouldForceBlur(const EffectWindow *w) const;
+    bool shouldForceBlur(const EffectWindow *w, const ForceBlurSettings &settings) const;
     void updateBlurRegion(EffectWindow *w, bool geometryChanged = false);
+
+    /**
+     * Requests the X11 blur region property of all specified windows that don't have it cached yet, then waits for
+     * all replies, which takes one round trip to the X server instead of one per window.
+     */
+    void fetchX11BlurRegions(const QList<EffectWindow *> &windows);
     bool hasStaticBlur(EffectWindow *w);
     QMatrix4x4 colorMatrix(const float &brightness, const float &saturation, const float &contrast) const;
 
+    /**
+     * Where blur() draws the blur and how it's produced.
+     */
+    enum class BlurPass
+    {
+        /// Drawn on the screen, the background is fetched and blurred where it's repainted.
+        Screen,
+        /// Drawn somewhere else, the render targets contain the result of the screen pass.
+        ReuseScreen,
+        /// Drawn somewhere else using the static blur texture if it exists, blurred without caching otherwise.
+        Static,
+        /// Drawn somewhere else, the whole background is fetched and blurred without caching.
+        Full
+    };
+
     /*
      * @param w The pointer to the window being blurred, nullptr if an image is being blurred.
      */
-    void blur(BlurRenderData &renderInfo, const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w, int mask, const QRegion &region, WindowPaintData &data);
+    void blur(BlurRenderData &renderInfo, const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w, int mask, const QRegion &region, WindowPaintData &data, BlurPass pass = BlurPass::Screen);
     void blur(GLTexture *texture);
 
+    /**
+     * @return How the window should be blurred if the render target isn't the screen that is being painted,
+     * std::nullopt if it is.
+     */
+    std::optional<SecondaryPassMode> secondaryPassMode(const RenderTarget &renderTarget) const;
+
+    /**
+     * Blurs a window drawn outside of the screen, e.g. into a screenshot, a screencast or a thumbnail.
+     */
+    void blurSecondaryPass(SecondaryPassMode mode, BlurEffectData &blurInfo, const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w, int mask, const QRegion &region, WindowPaintData &data);
+
+    /**
+     * @return The corner radii of the blurred area of the specified window, in the order top, bottom.
+     */
+    std::pair<float, float> cornerRadii(const EffectWindow *w, const QRegion &blurShape, const RenderViewport &viewport) const;
+
+    /**
+     * Reallocates the render targets if their sizes or format don't match.
+     * @return Whether the render targets are usable.
+     */
+    bool ensureRenderTargets(BlurRenderData &renderInfo, const std::vector<BlurRenderTarget> &renderTargets, GLenum textureFormat);
+
+    BlurMemoryUsage memoryUsage() const;
+
+    /**
+     * @return The values of the statistics that aren't counted, but computed when the statistics are read.
+     */
+    QVariantMap statisticsGauges() const;
+
+    /**
+     * Loads the shader drawing static blur textures, which is only needed if static blur is used.
+     * @return Whether the shader is loaded.
+     */
+    bool ensureTextureShader();
+
+    /**
+     * Loads the shader applying the color matrix to custom images blurred on the CPU.
+     * @return Whether the shader is loaded.
+     */
+    bool ensureColorMatrixShader();
+
+    /**
+     * Creates or destroys the debug overlay.
+     */
+    void toggleDebugOverlay();
+
+    /**
+     * Frees the render targets that weren't used for at least the specified time, starting with the ones that were
+     * used the longest time ago, until the memory usage is within the budget.
+     * @return The number of bytes freed.
+     */
+    qint64 freeIdleRenderTargets(std::chrono::milliseconds idleTime, qint64 budget);
+
+    /**
+     * Frees all textures. They are recreated when needed.
+     */
+    void freeAllTextures();
+
+    /**
+     * Frees the render targets and the static blur texture used for the screen. They are recreated when needed.
+     */
+    void freeScreenTextures(Output *screen);
+
+    /**
+     * Starts or stops pausing the blur on the screen, depending on whether its topmost window is an opaque full screen
+     * window.
+     *
+     * @return Whether the blur is paused on the screen.
+     */
+    bool updateFullScreenPause(Output *screen);
+
+    /**
+     * @return The topmost window on the screen if it's a full screen window that was opaque the last time it was
+     * painted, nullptr otherwise.
+     */
+    const EffectWindow *unobstructedFullScreenWindow(const Output *screen) const;
+
+    /**
+     * Called when the full screen window stops covering the screen in the middle of a frame.
+     */
+    void resumeFullScreenPause();
+
+    /**
+     * Frees the textures of the screens that have been paused for long enough.
+     */
+    void freePausedScreenTextures();
+
+    /**
+     * Called when render targets can't be allocated even after freeing the idle ones. Lowers the blur strength, which
+     * reduces the number and size of render targets, until the effect is reconfigured.
+     */
+    void reduceStrength();
+
+    /**
+     * Walks the windows from top to bottom and finds the parts of the blur regions that are hidden behind opaque
+     * windows above, assuming the opaque regions didn't change since the windows were last painted. The assumption is
+     * verified in prePaintWindow().
+     */
+    void predictOcclusion();
+
+    /**
+     * Called when a window doesn't hide what it was predicted to hide. The hidden parts of the blur regions of the
+     * windows already prepared for painting are added to the painted region.
+     */
+    void revealOccludedBlur(WindowPrePaintData &data);
+
+    /**
+     * @return The blur data of the window, or nullptr if it isn't blurred.
+     */
+    BlurEffectData *blurData(const EffectWindow *w);
+    const BlurEffectData *blurData(const EffectWindow *w) const;
+
+    /**
+     * @return The part of the blur region of the specified window that doesn't need to be blurred in this frame,
+     * because it's hidden behind opaque windows above or the opaque content of the window itself. In global logical
+     * coordinates.
+     */
+    QRegion occludedBlurArea(EffectWindow *w) const;
+
+    /**
+     * Finds the batch of windows to blur together on the current screen. If the background of the batch isn't up to
+     * date and the screen isn't repainted everywhere it's needed, the windows are blurred separately in this frame.
+     * They're also blurred separately if the render targets of the batch would exceed the memory budget.
+     */
+    void planBatch(const RenderTarget &renderTarget, const RenderViewport &viewport);
+
+    /**
+     * Called for every window that is drawn.
+     * @return The index of the window in the current batch, or -1 if it's not part of it or the batch was abandoned.
+     */
+    qsizetype advanceBatch(EffectWindow *w);
+
+    /**
+     * Fetches the backgrounds of the windows of the current batch starting at the specified index, and blurs the ones
+     * that are repainted.
+     * @return Whether the batch can be drawn.
+     */
+    bool blurBatch(qsizetype first, const RenderTarget &renderTarget, const RenderViewport &viewport);
+
+    /**
+     * @param processingRegion The area that would be blurred, in global logical coordinates.
+     * @return Whether the result of the last blur can be drawn again instead, because the update rate is limited and
+     * the last blur covered the area.
+     */
+    bool canReuseBlur(const BlurRenderData &renderInfo, const QRegion &processingRegion) const;
+
+    /**
+     * Draws the blurred background of the window at the specified index of the current batch, blurring the batch
+     * first if needed.
+     * @return Whether the background was drawn, false if the window has to be blurred separately.
+     */
+    bool blurBatched(qsizetype index, const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w, int mask, const QRegion &region, WindowPaintData &data);
+
+    /**
+     * Draws the blurred background of a window of the batch from the render targets of the batch.
+     * @param blurShape The blur shape of the window, in global logical coordinates.
+     * @param paintedArea The part of the shape to draw.
+     * @return Whether anything was drawn.
+     */
+    bool drawBatched(BlurBatchRenderData &renderData, const QRegion &blurShape, const QRegion &paintedArea, const RenderViewport &viewport, EffectWindow *w, const QRegion &region, const WindowPaintData &data);
+
+    /**
+     * Fetches the repainted part of the background of a window that is blurred separately into the shared background
+     * of its batch, so that the batch can continue to be used in the next frames.
+     */
+    void updateBatchBackground(const RenderTarget &renderTarget, const RenderViewport &viewport, EffectWindow *w);
+
+    QRect batchProcessingRect(const QRegion &shape, const QRect &backgroundRect) const;
+
+    /**
+     * @return The part of the screen under the specified window that is painted in this frame.
+     */
+    QRegion backgroundPaintRegion(EffectWindow *w) const;
+
     /**
      * @param output Can be nullptr.
      * @remark This method shall not be called outside of BlurEffect::blur.
      * @return The cached static blur texture. The texture will be created if it doesn't exist.
      */
-    GLTexture *ensureStaticBlurTexture(const Output *output, const RenderTarget &renderTarget);
+    StaticBlurTexture *ensureStaticBlurTexture(const Output *output, const RenderTarget &renderTarget);
+
+    /**
+     * @param output Can be nullptr, in which case the size of the X11 composite texture is returned.
+     * @return The size of the static blur texture before it's scaled down.
+     */
+    QSize staticBlurTextureSize(const Output *output) const;
+
+    /**
+     * Renders the texture into a new texture with the specified size and format, using linear filtering.
+     * @param colorMatrix If set, the colors are transformed with the matrix like in the first downsample pass.
+     * @return The new texture, or nullptr if the format isn't renderable or an error occurred.
+     */
+    std::unique_ptr<GLTexture> copyTexture(GLTexture *texture, const QSize &size, const GLenum &textureFormat, const QMatrix4x4 *colorMatrix = nullptr);
+
+    /**
+     * Applies the color matrix to a custom image that was blurred by the image loader, which can't do it itself since
+     * the matrix is applied after the transformation into the color space of the render target.
+     */
+    void applyColorMatrix(std::unique_ptr<GLTexture> &texture, const GLenum &textureFormat);
+
+    /**
+     * @param output Can be nullptr on X11.
+     * @param sourceKey Data identifying the source image.
+     * @return A hash identifying the static blur texture created for the specified output from the source image with
+     * the current settings. Used for sharing textures between outputs and as the disk cache key.
+     */
+    QByteArray staticBlurTextureKey(const Output *output, const QByteArray &sourceKey, const GLenum &textureFormat) const;
+
     GLTexture *ensureNoiseTexture();
 
     /**
@@ -121,11 +450,18 @@ private:
     GLTexture *wallpaper(EffectWindow *desktop, const qreal &scale, const GLenum &textureFormat);
 
     /**
-     * Creates a static blur texture for the specified screen.
+     * @remark This method shall not be called outside of BlurEffect::blur.
+     * @return The image to create the static blur texture for the specified screen from, or nullptr if an error
+     * occurred.
+     */
+    std::unique_ptr<GLTexture> staticBlurSourceTexture(const Output *output, const GLenum &textureFormat);
+
+    /**
+     * Creates a static blur texture from the specified source image.
      * @remark This method shall not be called outside of BlurEffect::blur.
      * @return A pointer to the texture, or nullptr if an error occurred.
      */
-    GLTexture *createStaticBlurTextureWayland(const Output *output, const RenderTarget &renderTarget, const GLenum &textureFormat);
+    GLTexture *createStaticBlurTextureWayland(std::unique_ptr<GLTexture> texture, const RenderTarget &renderTarget, const GLenum &textureFormat);
 
     /**
      * Creates a composite static blur texture containing images for all screens.
@@ -133,95 +469,146 @@ private:
      */
     GLTexture *createStaticBlurTextureX11(const GLenum &textureFormat);
 
+    /**
+     * Creates the engine for the algorithm selected in the settings. Falls back to the standard dual Kawase engine if
+     * the shaders of the selected one couldn't be loaded.
+     * @return The engine, or nullptr if no engine could be created.
+     */
+    std::unique_ptr<BlurEngine> createEngine() const;
+
+    /**
+     * Blurs a test image with both Kawase kernels and logs the difference between the results and the time each
+     * kernel took. Used for verifying the fetch-optimized kernel on a particular GPU.
+     */
+    void compareKernels();
+
 private:
-    struct
-    {
-        std::unique_ptr<GLShader> shader;
-        int mvpMatrixLocation;
-        int offsetLocation;
-        int halfpixelLocation;
-        int transformColorsLocation;
-        int colorMatrixLocation;
-    } m_downsamplePass;
+    std::unique_ptr<BlurEngine> m_engine;
 
+    /// Loaded from ProgramBinaryCache, so it isn't managed by ShaderManager.
     struct
     {
-        std::unique_ptr<GLShader> shader;
+        GLuint program = 0;
         int mvpMatrixLocation;
-        int offsetLocation;
-        int halfpixelLocation;
-        int textureLocation;
-
-        int noiseLocation;
-        int noiseTextureLocation;
-        int noiseTextureSizeLocation;
+        int textureSizeLocation;
+        int texStartPosLocation;
+        int scaleLocation;
 
         int topCornerRadiusLocation;
         int bottomCornerRadiusLocation;
         int antialiasingLocation;
         int blurSizeLocation;
         int opacityLocation;
-    } m_upsamplePass;
+
+        /// Set if loading the shader failed, it's not retried.
+        bool loadFailed = false;
+    } m_texture;
 
     struct
     {
         std::unique_ptr<GLShader> shader;
         int mvpMatrixLocation;
-        int textureSizeLocation;
-        int texStartPosLocation;
-        int scaleLocation;
+        int colorMatrixLocation;
 
-        int topCornerRadiusLocation;
-        int bottomCornerRadiusLocation;
-        int antialiasingLocation;
-        int blurSizeLocation;
-        int opacityLocation;
-    } m_texture;
+        /// Set if loading the shader failed, it's not retried.
+        bool loadFailed = false;
+    } m_colorMatrixPass;
 
     bool m_valid = false;
     long net_wm_blur_region = 0;
-    QRegion m_paintedArea; // keeps track of all painted areas (from bottom to top)
-    QRegion m_currentBlur; // keeps track of the currently blured area of the windows(from bottom to top)
     Output *m_currentScreen = nullptr;
+    std::chrono::milliseconds m_presentTime = std::chrono::milliseconds::zero();
 
-    size_t m_iterationCount; // number of times the texture will be downsized to half size
-    int m_offset;
-    int m_expandSize;
+    /// GL_MAX_TEXTURE_SIZE, queried when render targets are allocated the first time.
+    GLint m_maxTextureSize = 0;
 
-    std::unique_ptr<GLTexture> noiseTexture;
-    qreal noiseTextureScale = 1.0;
-    int noiseTextureStength = 0;
+    /// Set after render targets couldn't be allocated, until an allocation succeeds again. The strength is only
+    /// reduced once for every such period.
+    bool m_allocationFailing = false;
 
-    BlurSettings m_settings;
+    struct PaintedWindow
+    {
+        EffectWindow *window;
+
+        /// Empty if the window doesn't hide what's behind it.
+        QRegion opaque;
+        bool transformed;
+    };
 
-    struct OffsetStruct
+    struct ScreenFrameState
     {
-        float minOffset;
-        float maxOffset;
-        int expandSize;
+        /// All areas painted so far, from bottom to top.
+        QRegion paintedArea;
+
+        /// The blurred areas of the windows prepared so far, from bottom to top.
+        QRegion currentBlur;
+
+        /// The windows painted on the screen, from bottom to top.
+        QList<PaintedWindow> paintedWindows;
+        QRegion paintRegion;
+
+        /// The framebuffer of the screen while it's being painted, nullptr otherwise.
+        const GLFramebuffer *framebuffer = nullptr;
+
+        /// Set if nothing is blurred on the screen, because it's covered by a full screen window.
+        bool paused = false;
     };
 
-    QList<OffsetStruct> blurOffsets;
+    /// Outputs are painted independently of each other and at different rates, each of them has its own frame state.
+    /// The key is nullptr on X11, where all outputs are painted at once.
+    std::unordered_map<const Output *, ScreenFrameState> m_screenFrames;
+
+    /// The frame state of the screen that is being painted.
+    ScreenFrameState *m_frame = nullptr;
+
+    /// The opaque regions the current prediction relies on, of the windows that weren't prepared for painting yet.
+    std::unordered_map<EffectWindow *, QRegion> m_predictedOpaque;
 
-    struct BlurValuesStruct
+    /// The parts of the blur regions hidden behind opaque windows above in the current frame. They are neither fetched
+    /// nor blurred, except for the area sampled by the blur around the visible parts.
+    std::unordered_map<const EffectWindow *, QRegion> m_occludedBlur;
+
+    std::optional<BlurBatch> m_batch;
+    qsizetype m_batchPosition = 0;
+    bool m_batchBlurred = false;
+    std::unordered_map<Output *, BlurBatchRenderData> m_batchRender;
+
+    /// Shared by all windows blurred outside of the screen, nothing is reused between passes.
+    BlurRenderData m_secondaryRender;
+
+    struct FullScreenPause
     {
-        int iteration;
-        float offset;
+        /// Only compared, the window may have been deleted.
+        const EffectWindow *window = nullptr;
+        std::chrono::steady_clock::time_point since;
+        bool texturesFreed = false;
     };
 
-    QList<BlurValuesStruct> blurStrengthValues;
+    /// The screens covered by an opaque full screen window.
+    std::unordered_map<Output *, FullScreenPause> m_fullScreenPauses;
+    QTimer m_fullScreenPauseTimer;
+
+    int m_expandSize = 0;
+
+    /// The strength the engine is set to, lower than the configured one if render targets couldn't be allocated.
+    int m_strength = 0;
+
+    std::unique_ptr<GLTexture> noiseTexture;
+    qreal noiseTextureScale = 1.0;
+    int noiseTextureStength = 0;
 
-    std::unordered_map<const Output*, std::unique_ptr<GLTexture>> m_staticBlurTextures;
+    BlurSettings m_settings;
 
-    // Windows to blur even when transformed.
-    QList<const EffectWindow*> m_blurWhenTransformed;
+    // Textures are shared by outputs that would otherwise create identical textures.
+    std::unordered_map<const Output*, std::shared_ptr<StaticBlurTexture>> m_staticBlurTextures;
+    StaticBlurCache m_staticBlurCache;
+    /// Keys that weren't found in the disk cache, they aren't looked up again until the settings change.
+    QSet<QByteArray> m_staticBlurCacheMisses;
+    StaticBlurImageLoader m_imageLoader;
 
     QMatrix4x4 m_colorMatrix;
 
-    QMap<EffectWindow *, QMetaObject::Connection> windowBlurChangedConnections;
-    QMap<EffectWindow *, QMetaObject::Connection> windowFrameGeometryChangedConnections;
     QMap<Output *, QMetaObject::Connection> screenChangedConnections;
-    std::unordered_map<EffectWindow *, BlurEffectData> m_windows;
 
     /**
      * Stores all currently open windows, even those that aren't blurred. Used for determining whether windows are
@@ -230,7 +617,12 @@ private:
      * Objects retrieved from effects->stackingOrder() and workspace()->stackingOrder() appear to be deleted when
      * BlurEffect::prePaintWindow is running, so that can't be used.
      */
-    std::vector<EffectWindow *> m_allWindows;
+    WindowRecordStore<WindowRecord> m_records;
+
+    BlurStatistics m_statistics;
+
+    /// nullptr unless the debug overlay is enabled.
+    std::unique_ptr<BlurDebugOverlay> m_debugOverlay;
 
     static BlurManagerInterface *s_blurManager;
     static QTimer *s_blurManagerRemoveTimer;
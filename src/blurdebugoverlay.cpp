@@ -0,0 +1,317 @@
+#include "blurdebugoverlay.h"
+
+#include "core/pixelgrid.h"
+#include "core/renderviewport.h"
+#include "effect/effecthandler.h"
+
+#include <QFontMetrics>
+#include <QGuiApplication>
+#include <QLoggingCategory>
+#include <QPainter>
+
+#include <algorithm>
+#include <tuple>
+
+Q_DECLARE_LOGGING_CATEGORY(KWIN_BLUR)
+
+namespace KWin
+{
+
+static const QColor s_staticColor(0, 100, 255, 80);
+static const QColor s_blurredColor(0, 255, 0, 80);
+static const QColor s_reusedColor(255, 255, 0, 80);
+static const QColor s_occludedColor(255, 0, 0, 80);
+static const QColor s_backgroundColor(255, 255, 255, 200);
+static const QColor s_repaintColor(255, 0, 255, 200);
+
+// The width of the outlines, in device pixels.
+static constexpr qreal s_outlineWidth = 2;
+
+static QVector4D colorVector(const QColor &color)
+{
+    return QVector4D(color.redF(), color.greenF(), color.blueF(), color.alphaF());
+}
+
+BlurDebugOverlay::BlurDebugOverlay()
+{
+    m_shader.shader = ShaderManager::instance()->generateShaderFromFile(ShaderTrait::MapTexture,
+                                                                        QStringLiteral(":/effects/forceblur/shaders/vertex.vert"),
+                                                                        QStringLiteral(":/effects/forceblur/shaders/debug.frag"));
+    if (!m_shader.shader) {
+        qCWarning(KWIN_BLUR) << "Failed to load the debug overlay shader";
+        return;
+    }
+    m_shader.mvpMatrixLocation = m_shader.shader->uniformLocation("modelViewProjectionMatrix");
+    m_shader.colorLocation = m_shader.shader->uniformLocation("color");
+    m_shader.useTextureLocation = m_shader.shader->uniformLocation("useTexture");
+    m_shader.textureLocation = m_shader.shader->uniformLocation("texUnit");
+
+    // OpenGL ES only has timer queries through an extension with different names.
+    m_timerQueries = epoxy_is_desktop_gl() && (epoxy_gl_version() >= 33 || epoxy_has_gl_extension("GL_ARB_timer_query"));
+}
+
+BlurDebugOverlay::~BlurDebugOverlay()
+{
+    std::vector<GLuint> queries = m_freeQueries;
+    for (const PendingQuery &pending : m_pendingQueries) {
+        queries.push_back(pending.query);
+    }
+    if (m_activeQuery) {
+        glEndQuery(GL_TIME_ELAPSED);
+        queries.push_back(m_activeQuery->query);
+    }
+    if (!queries.empty()) {
+        glDeleteQueries(queries.size(), queries.data());
+    }
+}
+
+bool BlurDebugOverlay::isValid() const
+{
+    return m_shader.shader != nullptr;
+}
+
+void BlurDebugOverlay::beginFrame()
+{
+    m_windows.clear();
+
+    std::erase_if(m_pendingQueries, [this](const PendingQuery &pending) {
+        GLint available = 0;
+        glGetQueryObjectiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return false;
+        }
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(pending.query, GL_QUERY_RESULT, &elapsed);
+        m_gpuTimes[pending.window] = elapsed / 1'000'000.0;
+        m_freeQueries.push_back(pending.query);
+        return true;
+    });
+}
+
+BlurDebugWindow &BlurDebugOverlay::window(const EffectWindow *w)
+{
+    auto it = std::find_if(m_windows.begin(), m_windows.end(), [w](const auto &entry) {
+        return entry.first == w;
+    });
+    if (it == m_windows.end()) {
+        return m_windows.emplace_back(w, BlurDebugWindow()).second;
+    }
+    return it->second;
+}
+
+void BlurDebugOverlay::beginGpuTimer(const EffectWindow *w)
+{
+    // Timer queries can't be nested.
+    if (!m_timerQueries || m_activeQuery) {
+        return;
+    }
+    if (std::any_of(m_pendingQueries.begin(), m_pendingQueries.end(), [w](const PendingQuery &pending) {
+            return pending.window == w;
+        })) {
+        return;
+    }
+
+    GLuint query;
+    if (!m_freeQueries.empty()) {
+        query = m_freeQueries.back();
+        m_freeQueries.pop_back();
+    } else {
+        glGenQueries(1, &query);
+    }
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    m_activeQuery = PendingQuery{w, query};
+}
+
+void BlurDebugOverlay::endGpuTimer()
+{
+    if (!m_activeQuery) {
+        return;
+    }
+
+    glEndQuery(GL_TIME_ELAPSED);
+    m_pendingQueries.push_back(*m_activeQuery);
+    m_activeQuery.reset();
+}
+
+void BlurDebugOverlay::windowDeleted(const EffectWindow *w)
+{
+    m_gpuTimes.erase(w);
+    std::erase_if(m_windows, [w](const auto &entry) {
+        return entry.first == w;
+    });
+
+    // The results of the queries are never read, the queries can be reused right away.
+    std::erase_if(m_pendingQueries, [this, w](const PendingQuery &pending) {
+        if (pending.window != w) {
+            return false;
+        }
+        m_freeQueries.push_back(pending.query);
+        return true;
+    });
+}
+
+void BlurDebugOverlay::addClippedRect(std::vector<GLVertex2D> &vertices, const QRectF &rect, const QRegion &region, qreal scale) const
+{
+    for (const QRect &clipRect : region) {
+        const QRectF clipped = rect.intersected(clipRect);
+        if (clipped.isEmpty()) {
+            continue;
+        }
+
+        const QRectF device = snapToPixelGridF(scaledRect(clipped, scale));
+        const float u0 = (clipped.left() - rect.left()) / rect.width();
+        const float v0 = (clipped.top() - rect.top()) / rect.height();
+        const float u1 = (clipped.right() - rect.left()) / rect.width();
+        const float v1 = (clipped.bottom() - rect.top()) / rect.height();
+
+        vertices.push_back({.position = QVector2D(device.left(), device.top()), .texcoord = QVector2D(u0, v0)});
+        vertices.push_back({.position = QVector2D(device.right(), device.bottom()), .texcoord = QVector2D(u1, v1)});
+        vertices.push_back({.position = QVector2D(device.left(), device.bottom()), .texcoord = QVector2D(u0, v1)});
+        vertices.push_back({.position = QVector2D(device.left(), device.top()), .texcoord = QVector2D(u0, v0)});
+        vertices.push_back({.position = QVector2D(device.right(), device.top()), .texcoord = QVector2D(u1, v0)});
+        vertices.push_back({.position = QVector2D(device.right(), device.bottom()), .texcoord = QVector2D(u1, v1)});
+    }
+}
+
+QImage BlurDebugOverlay::label(const EffectWindow *w, const BlurDebugWindow &info) const
+{
+    QString text = QStringLiteral("%1 passes").arg(info.passes);
+    if (auto it = m_gpuTimes.find(w); it != m_gpuTimes.end()) {
+        text += QStringLiteral(", %1 ms GPU").arg(it->second, 0, 'f', 2);
+    }
+
+    const QFont font = QGuiApplication::font();
+    const QFontMetrics metrics(font);
+    const QRect textRect = metrics.boundingRect(text).adjusted(-4, -2, 4, 2);
+
+    QImage image(textRect.size(), QImage::Format_RGBA8888_Premultiplied);
+    image.fill(QColor(0, 0, 0, 160));
+
+    QPainter painter(&image);
+    painter.setFont(font);
+    painter.setPen(Qt::white);
+    painter.drawText(image.rect(), Qt::AlignCenter, text);
+    return image;
+}
+
+void BlurDebugOverlay::paint(const RenderViewport &viewport, const QRegion &region)
+{
+    if (m_windows.empty()) {
+        return;
+    }
+
+    const qreal scale = viewport.scale();
+    const qreal outlineWidth = s_outlineWidth / scale;
+    const auto addOutline = [this, &region, scale, outlineWidth](std::vector<GLVertex2D> &vertices, const QRectF &rect) {
+        addClippedRect(vertices, QRectF(rect.left(), rect.top(), rect.width(), outlineWidth), region, scale);
+        addClippedRect(vertices, QRectF(rect.left(), rect.bottom() - outlineWidth, rect.width(), outlineWidth), region, scale);
+        addClippedRect(vertices, QRectF(rect.left(), rect.top(), outlineWidth, rect.height()), region, scale);
+        addClippedRect(vertices, QRectF(rect.right() - outlineWidth, rect.top(), outlineWidth, rect.height()), region, scale);
+    };
+
+    // Everything except the labels is drawn from one buffer, one range per color.
+    std::vector<GLVertex2D> vertices;
+    std::vector<std::tuple<QColor, int, int>> ranges;
+    const auto addRange = [&vertices, &ranges](const QColor &color, const auto &addVertices) {
+        const int first = vertices.size();
+        addVertices();
+        if (const int count = vertices.size() - first; count > 0) {
+            ranges.emplace_back(color, first, count);
+        }
+    };
+    const auto addFill = [this, &vertices, &region, scale, &addRange](const QColor &color, QRegion BlurDebugWindow::*area) {
+        addRange(color, [&]() {
+            for (const auto &[w, info] : m_windows) {
+                for (const QRect &rect : info.*area) {
+                    addClippedRect(vertices, rect, region, scale);
+                }
+            }
+        });
+    };
+
+    addFill(s_staticColor, &BlurDebugWindow::staticArea);
+    addFill(s_blurredColor, &BlurDebugWindow::blurredArea);
+    addFill(s_reusedColor, &BlurDebugWindow::reusedArea);
+    addFill(s_occludedColor, &BlurDebugWindow::occludedArea);
+    addRange(s_backgroundColor, [&]() {
+        for (const auto &[w, info] : m_windows) {
+            if (!info.backgroundRect.isEmpty()) {
+                addOutline(vertices, info.backgroundRect);
+            }
+        }
+    });
+    addRange(s_repaintColor, [&]() {
+        for (const auto &[w, info] : m_windows) {
+            for (const QRect &rect : info.repaintArea) {
+                addOutline(vertices, rect);
+            }
+        }
+    });
+
+    // Labels are drawn at the top left corner of the blurred area, at their actual size in device pixels.
+    std::vector<std::tuple<std::unique_ptr<GLTexture>, int, int>> labels;
+    for (const auto &[w, info] : m_windows) {
+        const QRect area = (info.staticArea | info.blurredArea | info.reusedArea | info.occludedArea).boundingRect();
+        if (area.isEmpty()) {
+            continue;
+        }
+
+        const QImage image = label(w, info);
+        const int first = vertices.size();
+        addClippedRect(vertices, QRectF(area.topLeft(), QSizeF(image.size()) / scale), region, scale);
+        const int count = vertices.size() - first;
+        if (count == 0) {
+            continue;
+        }
+        if (auto texture = GLTexture::upload(image)) {
+            texture->setFilter(GL_NEAREST);
+            labels.emplace_back(std::move(texture), first, count);
+        }
+    }
+
+    if (vertices.empty()) {
+        return;
+    }
+
+    GLVertexBuffer *vbo = GLVertexBuffer::streamingBuffer();
+    vbo->reset();
+    vbo->setAttribLayout(std::span(GLVertexBuffer::GLVertex2DLayout), sizeof(GLVertex2D));
+    if (auto result = vbo->map<GLVertex2D>(vertices.size())) {
+        std::copy(vertices.begin(), vertices.end(), result->begin());
+        vbo->unmap();
+    } else {
+        qCWarning(KWIN_BLUR) << "Failed to map vertex buffer";
+        return;
+    }
+
+    ShaderManager::instance()->pushShader(m_shader.shader.get());
+    m_shader.shader->setUniform(m_shader.mvpMatrixLocation, viewport.projectionMatrix());
+    m_shader.shader->setUniform(m_shader.textureLocation, 0);
+
+    vbo->bindArrays();
+    glEnable(GL_BLEND);
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    m_shader.shader->setUniform(m_shader.useTextureLocation, false);
+    for (const auto &[color, first, count] : ranges) {
+        m_shader.shader->setUniform(m_shader.colorLocation, colorVector(color));
+        vbo->draw(GL_TRIANGLES, first, count);
+    }
+
+    // The labels are premultiplied.
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    m_shader.shader->setUniform(m_shader.useTextureLocation, true);
+    m_shader.shader->setUniform(m_shader.colorLocation, QVector4D(1, 1, 1, 1));
+    glActiveTexture(GL_TEXTURE0);
+    for (const auto &[texture, first, count] : labels) {
+        texture->bind();
+        vbo->draw(GL_TRIANGLES, first, count);
+    }
+
+    glDisable(GL_BLEND);
+    vbo->unbindArrays();
+    ShaderManager::instance()->popShader();
+}
+
+}
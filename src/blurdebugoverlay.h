@@ -0,0 +1,123 @@
+#pragma once
+
+#include "opengl/glutils.h"
+
+#include <QImage>
+#include <QRegion>
+
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace KWin
+{
+
+class EffectWindow;
+class RenderViewport;
+
+/**
+ * What happened to the blur of a window in the current frame. All regions are in global logical coordinates.
+ */
+struct BlurDebugWindow
+{
+    /// Painted using the static blur texture.
+    QRegion staticArea;
+
+    /// Blurred in this frame.
+    QRegion blurredArea;
+
+    /// Painted using the result of an earlier blur, because the update rate is limited.
+    QRegion reusedArea;
+
+    /// Neither fetched nor blurred, because it's hidden behind opaque windows or the opaque content of the window.
+    QRegion occludedArea;
+
+    /// The part of the blur region that was scheduled for repainting, expanded by the damage behind the window.
+    QRegion repaintArea;
+
+    /// The area of the screen that was captured for blurring, empty if nothing was captured.
+    QRect backgroundRect;
+
+    /// The number of passes run by the blur engine to blur and draw the window, including the static blur texture.
+    int passes = 0;
+};
+
+/**
+ * Draws the blurred areas of all windows on top of the screen, tinted depending on how they were painted, together
+ * with the captured and repainted areas, the number of passes and the GPU time of every window.
+ *
+ * Only what is painted in the current frame is drawn, like with the Show Paint effect, so the overlay of windows that
+ * aren't repainted stays on the screen as long as nothing else is painted over it.
+ */
+class BlurDebugOverlay
+{
+public:
+    BlurDebugOverlay();
+    ~BlurDebugOverlay();
+
+    /**
+     * @return Whether the shader was loaded.
+     */
+    bool isValid() const;
+
+    /**
+     * Forgets the windows of the previous frame and collects the GPU times of the finished frames.
+     */
+    void beginFrame();
+
+    /**
+     * @return The information about the window in the current frame, created if it doesn't exist.
+     */
+    BlurDebugWindow &window(const EffectWindow *w);
+
+    /**
+     * Measures the GPU time of the commands issued until endGpuTimer() is called. Nothing is measured if timer queries
+     * aren't supported or the previous measurement of the window isn't available yet.
+     */
+    void beginGpuTimer(const EffectWindow *w);
+    void endGpuTimer();
+
+    void windowDeleted(const EffectWindow *w);
+
+    /**
+     * Draws the windows of the current frame, clipped to the painted region.
+     */
+    void paint(const RenderViewport &viewport, const QRegion &region);
+
+private:
+    struct PendingQuery
+    {
+        const EffectWindow *window;
+        GLuint query;
+    };
+
+    /**
+     * Adds the parts of the rect inside the region to the vertex list, converted to device pixels. Texture
+     * coordinates map the whole rect to the whole texture.
+     */
+    void addClippedRect(std::vector<GLVertex2D> &vertices, const QRectF &rect, const QRegion &region, qreal scale) const;
+
+    QImage label(const EffectWindow *w, const BlurDebugWindow &info) const;
+
+    struct
+    {
+        std::unique_ptr<GLShader> shader;
+        int mvpMatrixLocation;
+        int colorLocation;
+        int useTextureLocation;
+        int textureLocation;
+    } m_shader;
+
+    std::vector<std::pair<const EffectWindow *, BlurDebugWindow>> m_windows;
+
+    bool m_timerQueries = false;
+    std::vector<GLuint> m_freeQueries;
+    std::vector<PendingQuery> m_pendingQueries;
+    std::optional<PendingQuery> m_activeQuery;
+
+    /// The last measured GPU times of the windows, in milliseconds.
+    std::unordered_map<const EffectWindow *, double> m_gpuTimes;
+};
+
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "opengl/glutils.h"
+
+#include <QMatrix4x4>
+#include <QRegion>
+#include <QSize>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace KWin
+{
+
+struct BlurRenderData
+{
+    /// Temporary render targets needed by the blur engine, the first texture contains not blurred background behind
+    /// the window, it's cached.
+    std::vector<std::unique_ptr<GLTexture>> textures;
+    std::vector<std::unique_ptr<GLFramebuffer>> framebuffers;
+
+    /// The area of the screen that was blurred the last time and when, in global logical coordinates. The result stays
+    /// in the render targets until the next blur, it's reused when the update rate is limited.
+    QRegion blurredArea;
+    std::chrono::milliseconds blurTime = std::chrono::milliseconds::zero();
+
+    /// The presentation time of the last frame the render targets were used in. Render targets that weren't used for a
+    /// while are freed first when the memory budget is exceeded.
+    std::chrono::milliseconds lastUsedTime = std::chrono::milliseconds::zero();
+};
+
+struct BlurRenderTarget
+{
+    QSize size;
+
+    /// Whether the texture needs a complete mipmap chain.
+    bool mipmaps = false;
+};
+
+/**
+ * Parameters of the pass that draws the blurred background on the screen.
+ */
+struct BlurDrawParameters
+{
+    QMatrix4x4 projectionMatrix;
+
+    /// The size of the background in logical pixels.
+    QSizeF blurSize;
+
+    /// The area of the window in the background, in logical pixels with the origin at the bottom left corner. Only set
+    /// when the background is shared by multiple windows, the rounded corners are applied to this area instead.
+    QRectF blurRect;
+
+    /// The scale of the viewport the background is drawn on.
+    qreal scale = 1;
+
+    float topCornerRadius = 0;
+    float bottomCornerRadius = 0;
+    float antialiasing = 0;
+    float opacity = 1;
+
+    /// nullptr if noise is disabled.
+    GLTexture *noiseTexture = nullptr;
+};
+
+/**
+ * A blur algorithm. BlurEffect captures the background and uploads the geometry, the engine blurs the background and
+ * draws the result.
+ */
+class BlurEngine
+{
+public:
+    virtual ~BlurEngine() = default;
+
+    /**
+     * @return Whether all shaders were loaded.
+     */
+    virtual bool isValid() const = 0;
+
+    /**
+     * @param strength The blur strength from the settings, starting at 0.
+     */
+    virtual void setStrength(int strength) = 0;
+
+    /**
+     * @return How far outside of a region the blur samples the background, in logical pixels.
+     */
+    virtual int expandSize() const = 0;
+
+    /**
+     * @return The render targets needed to blur a background of the specified size. The first one must have the size
+     * of the background and no mipmaps.
+     */
+    virtual std::vector<BlurRenderTarget> renderTargets(const QSize &backgroundSize) const = 0;
+
+    /**
+     * @return The number of passes blur() runs, not counting draw().
+     */
+    virtual int blurPassCount() const = 0;
+
+    /**
+     * Blurs the background in the first render target. The first vertexCount vertices of the bound vertex buffer contain
+     * the areas to process, in logical pixels relative to the background. The framebuffer stack is left unchanged.
+     * @param boundingRect The bounding rectangle of the areas to process, for engines that can't use the vertices.
+     */
+    virtual void blur(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int vertexCount, const QRect &boundingRect, const QSize &backgroundSize, const QMatrix4x4 &colorMatrix) = 0;
+
+    /**
+     * Draws the blurred background into the current framebuffer using the specified vertices of the bound vertex
+     * buffer.
+     */
+    virtual void draw(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int first, int count, const BlurDrawParameters &parameters) = 0;
+};
+
+}
@@ -0,0 +1,147 @@
+#include "blurstatistics.h"
+
+#include "core/output.h"
+
+#include <QDBusConnection>
+
+#include <algorithm>
+
+namespace KWin
+{
+
+static const QString s_objectPath = QStringLiteral("/BetterBlur");
+
+BlurStatistics::Timer::Timer(BlurStatistics &statistics, Timing timing)
+    : m_statistics(statistics)
+    , m_timing(timing)
+{
+    m_timer.start();
+}
+
+BlurStatistics::Timer::~Timer()
+{
+    stop();
+}
+
+void BlurStatistics::Timer::start()
+{
+    m_timer.start();
+}
+
+void BlurStatistics::Timer::stop()
+{
+    if (m_timer.isValid()) {
+        m_statistics.addTime(m_timing, m_timer.nsecsElapsed());
+        m_timer.invalidate();
+    }
+}
+
+BlurStatistics::BlurStatistics(std::function<QVariantMap()> gauges)
+    : m_gauges(std::move(gauges))
+{
+    QDBusConnection::sessionBus().registerObject(s_objectPath, this, QDBusConnection::ExportScriptableContents);
+}
+
+BlurStatistics::~BlurStatistics()
+{
+    QDBusConnection::sessionBus().unregisterObject(s_objectPath);
+}
+
+void BlurStatistics::beginFrame(const Output *output)
+{
+    m_output = output ? output->name() : QString();
+    m_frame = FrameStatistics();
+}
+
+void BlurStatistics::endFrame()
+{
+    m_lastFrames[m_output] = m_frame;
+
+    m_counters.frames++;
+    m_counters.prePaintWindowTime += m_frame.prePaintWindowTime;
+    m_counters.maxPrePaintWindowTime = std::max(m_counters.maxPrePaintWindowTime, m_frame.prePaintWindowTime);
+    m_counters.blurTime += m_frame.blurTime;
+    m_counters.maxBlurTime = std::max(m_counters.maxBlurTime, m_frame.blurTime);
+}
+
+void BlurStatistics::windowBlurred()
+{
+    m_frame.blurredWindows++;
+}
+
+void BlurStatistics::regionProcessed(int rectCount)
+{
+    m_frame.regionRects += rectCount;
+}
+
+void BlurStatistics::renderTargetsAllocated(bool reallocated)
+{
+    if (reallocated) {
+        m_counters.renderTargetReallocations++;
+    } else {
+        m_counters.renderTargetAllocations++;
+    }
+}
+
+void BlurStatistics::staticBlurTextureCreated()
+{
+    m_counters.staticBlurTextureBuilds++;
+}
+
+void BlurStatistics::staticBlurTextureShared()
+{
+    m_counters.staticBlurTextureShares++;
+}
+
+void BlurStatistics::staticBlurTextureLoadedFromCache()
+{
+    m_counters.staticBlurTextureCacheHits++;
+}
+
+void BlurStatistics::addTime(Timing timing, qint64 nsecs)
+{
+    switch (timing) {
+    case Timing::PrePaintWindow:
+        m_frame.prePaintWindowTime += nsecs;
+        break;
+    case Timing::Blur:
+        m_frame.blurTime += nsecs;
+        break;
+    }
+}
+
+QVariantMap BlurStatistics::statistics() const
+{
+    // Times are in microseconds.
+    QVariantMap statistics = m_gauges();
+    statistics[QStringLiteral("frames")] = m_counters.frames;
+    statistics[QStringLiteral("prePaintWindowTimeAverage")] = m_counters.frames ? m_counters.prePaintWindowTime / 1000.0 / m_counters.frames : 0.0;
+    statistics[QStringLiteral("prePaintWindowTimeMax")] = m_counters.maxPrePaintWindowTime / 1000.0;
+    statistics[QStringLiteral("blurTimeAverage")] = m_counters.frames ? m_counters.blurTime / 1000.0 / m_counters.frames : 0.0;
+    statistics[QStringLiteral("blurTimeMax")] = m_counters.maxBlurTime / 1000.0;
+    statistics[QStringLiteral("renderTargetAllocations")] = m_counters.renderTargetAllocations;
+    statistics[QStringLiteral("renderTargetReallocations")] = m_counters.renderTargetReallocations;
+    statistics[QStringLiteral("staticBlurTextureBuilds")] = m_counters.staticBlurTextureBuilds;
+    statistics[QStringLiteral("staticBlurTextureShares")] = m_counters.staticBlurTextureShares;
+    statistics[QStringLiteral("staticBlurTextureCacheHits")] = m_counters.staticBlurTextureCacheHits;
+
+    QVariantMap outputs;
+    for (auto it = m_lastFrames.begin(); it != m_lastFrames.end(); ++it) {
+        outputs[it.key()] = QVariantMap{
+            {QStringLiteral("blurredWindows"), it->blurredWindows},
+            {QStringLiteral("regionRects"), it->regionRects},
+            {QStringLiteral("prePaintWindowTime"), it->prePaintWindowTime / 1000.0},
+            {QStringLiteral("blurTime"), it->blurTime / 1000.0},
+        };
+    }
+    statistics[QStringLiteral("outputs")] = outputs;
+    return statistics;
+}
+
+void BlurStatistics::reset()
+{
+    m_counters = Counters();
+    m_lastFrames.clear();
+}
+
+}
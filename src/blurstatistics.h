@@ -0,0 +1,113 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QVariantMap>
+
+#include <functional>
+
+namespace KWin
+{
+
+class Output;
+
+/**
+ * Counters describing what the effect is doing, exported on the session bus as /BetterBlur, so that regressions can
+ * be noticed without a debugger:
+ *
+ *     qdbus org.kde.KWin /BetterBlur org.kde.KWin.BetterBlur.Statistics.statistics
+ *
+ * Values that can be computed at any time, such as the memory usage, aren't counted but requested from the effect
+ * when the statistics are read.
+ */
+class BlurStatistics : public QObject
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.kde.KWin.BetterBlur.Statistics")
+
+public:
+    enum class Timing {
+        PrePaintWindow,
+        Blur,
+    };
+
+    /**
+     * Measures the time between its creation or the last call to start() and its destruction or the call to stop().
+     */
+    class Timer
+    {
+    public:
+        Timer(BlurStatistics &statistics, Timing timing);
+        ~Timer();
+
+        void start();
+        void stop();
+
+    private:
+        BlurStatistics &m_statistics;
+        Timing m_timing;
+        QElapsedTimer m_timer;
+    };
+
+    /**
+     * @param gauges Returns the values that aren't counted, added to the result of statistics().
+     */
+    explicit BlurStatistics(std::function<QVariantMap()> gauges);
+    ~BlurStatistics() override;
+
+    /**
+     * Called before the output is painted. Nothing is counted for the frame if the output isn't painted afterwards.
+     * @param output Can be nullptr on X11.
+     */
+    void beginFrame(const Output *output);
+    void endFrame();
+
+    void windowBlurred();
+    void regionProcessed(int rectCount);
+    void renderTargetsAllocated(bool reallocated);
+    void staticBlurTextureCreated();
+    void staticBlurTextureShared();
+    void staticBlurTextureLoadedFromCache();
+
+    /**
+     * @return All counters since the last reset and the values of the last painted frame of every output.
+     */
+    Q_SCRIPTABLE QVariantMap statistics() const;
+    Q_SCRIPTABLE void reset();
+
+private:
+    struct FrameStatistics
+    {
+        int blurredWindows = 0;
+        int regionRects = 0;
+        qint64 prePaintWindowTime = 0;
+        qint64 blurTime = 0;
+    };
+
+    void addTime(Timing timing, qint64 nsecs);
+
+    std::function<QVariantMap()> m_gauges;
+
+    QString m_output;
+    FrameStatistics m_frame;
+    QHash<QString, FrameStatistics> m_lastFrames;
+
+    struct Counters
+    {
+        quint64 frames = 0;
+        qint64 prePaintWindowTime = 0;
+        qint64 maxPrePaintWindowTime = 0;
+        qint64 blurTime = 0;
+        qint64 maxBlurTime = 0;
+
+        quint64 renderTargetAllocations = 0;
+        quint64 renderTargetReallocations = 0;
+        quint64 staticBlurTextureBuilds = 0;
+        quint64 staticBlurTextureShares = 0;
+        quint64 staticBlurTextureCacheHits = 0;
+    } m_counters;
+};
+
+}
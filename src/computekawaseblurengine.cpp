@@ -0,0 +1,221 @@
+#include "computekawaseblurengine.h"
+
+#include <QFile>
+#include <QLoggingCategory>
+
+#include <cmath>
+
+Q_DECLARE_LOGGING_CATEGORY(KWIN_BLUR)
+
+namespace KWin
+{
+
+// The compute shaders process 8x8 texels per work group.
+static constexpr int s_workGroupSize = 8;
+
+ComputeKawaseBlurEngine::ComputeKawaseBlurEngine()
+    : KawaseBlurEngine(KawaseKernel::Standard)
+{
+}
+
+ComputeKawaseBlurEngine::~ComputeKawaseBlurEngine()
+{
+    for (const auto &[format, programs] : m_programs) {
+        if (programs) {
+            glDeleteProgram(programs->downsample.program);
+            glDeleteProgram(programs->upsample.program);
+        }
+    }
+}
+
+bool ComputeKawaseBlurEngine::isSupported()
+{
+    if (epoxy_is_desktop_gl()) {
+        return epoxy_gl_version() >= 43 || epoxy_has_gl_extension("GL_ARB_compute_shader");
+    }
+    return epoxy_gl_version() >= 31;
+}
+
+GLuint ComputeKawaseBlurEngine::compileProgram(const QString &fileName, const QByteArray &imageFormat)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCWarning(KWIN_BLUR) << "Failed to read" << fileName;
+        return 0;
+    }
+
+    QByteArray source = epoxy_is_desktop_gl()
+        ? QByteArrayLiteral("#version 430 core\n")
+        : QByteArrayLiteral("#version 310 es\nprecision highp float;\nprecision highp sampler2D;\nprecision highp image2D;\n");
+    source += "#define OUTPUT_FORMAT " + imageFormat + "\n";
+    source += file.readAll();
+
+    if (const GLuint program = m_binaryCache.load(source)) {
+        return program;
+    }
+
+    const GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+    const char *sourceData = source.constData();
+    glShaderSource(shader, 1, &sourceData, nullptr);
+    glCompileShader(shader);
+
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        GLint logLength = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+        QByteArray log(logLength, '\0');
+        glGetShaderInfoLog(shader, logLength, nullptr, log.data());
+        qCWarning(KWIN_BLUR) << "Failed to compile" << fileName << log;
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    const GLuint program = glCreateProgram();
+    if (m_binaryCache.isSupported()) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    glDeleteShader(shader);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        qCWarning(KWIN_BLUR) << "Failed to link" << fileName;
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    m_binaryCache.store(source, program);
+    return program;
+}
+
+const ComputeKawaseBlurEngine::Programs *ComputeKawaseBlurEngine::programs(GLenum format)
+{
+    if (auto it = m_programs.find(format); it != m_programs.end()) {
+        return it->second ? &*it->second : nullptr;
+    }
+
+    // The format qualifier of the image must match the internal format of the render targets.
+    QByteArray imageFormat;
+    switch (format) {
+    case GL_RGBA8:
+        imageFormat = QByteArrayLiteral("rgba8");
+        break;
+    case GL_RGBA16F:
+        imageFormat = QByteArrayLiteral("rgba16f");
+        break;
+    case GL_RGB10_A2:
+        if (epoxy_is_desktop_gl()) {
+            imageFormat = QByteArrayLiteral("rgb10_a2");
+        }
+        break;
+    }
+
+    auto &programs = m_programs[format];
+    if (imageFormat.isEmpty()) {
+        return nullptr;
+    }
+
+    Programs result;
+    result.downsample.program = compileProgram(QStringLiteral(":/effects/forceblur/shaders/kawase_downsample.comp"), imageFormat);
+    result.upsample.program = compileProgram(QStringLiteral(":/effects/forceblur/shaders/kawase_upsample.comp"), imageFormat);
+    if (!result.downsample.program || !result.upsample.program) {
+        glDeleteProgram(result.downsample.program);
+        glDeleteProgram(result.upsample.program);
+        return nullptr;
+    }
+
+    result.downsample.offsetLocation = glGetUniformLocation(result.downsample.program, "offset");
+    result.downsample.halfpixelLocation = glGetUniformLocation(result.downsample.program, "halfpixel");
+    result.downsample.transformColorsLocation = glGetUniformLocation(result.downsample.program, "transformColors");
+    result.downsample.colorMatrixLocation = glGetUniformLocation(result.downsample.program, "colorMatrix");
+    result.downsample.region.offsetLocation = glGetUniformLocation(result.downsample.program, "regionOffset");
+    result.downsample.region.sizeLocation = glGetUniformLocation(result.downsample.program, "regionSize");
+    result.upsample.offsetLocation = glGetUniformLocation(result.upsample.program, "offset");
+    result.upsample.halfpixelLocation = glGetUniformLocation(result.upsample.program, "halfpixel");
+    result.upsample.region.offsetLocation = glGetUniformLocation(result.upsample.program, "regionOffset");
+    result.upsample.region.sizeLocation = glGetUniformLocation(result.upsample.program, "regionSize");
+
+    programs = result;
+    return &*programs;
+}
+
+QRect ComputeKawaseBlurEngine::levelRect(const QRect &rect, const QSize &backgroundSize, const QSize &levelSize)
+{
+    // The rectangle has its origin at the top left corner, like the vertices, while the rows of the textures start at
+    // the bottom.
+    const int top = backgroundSize.height() - rect.y() - rect.height();
+
+    // The texels whose centers are covered by the rectangle scaled to the level, like when the fragment shaders
+    // rasterize the same area.
+    const qreal scaleX = qreal(levelSize.width()) / backgroundSize.width();
+    const qreal scaleY = qreal(levelSize.height()) / backgroundSize.height();
+    const QPoint topLeft(std::floor(rect.x() * scaleX), std::floor(top * scaleY));
+    const QPoint bottomRight(std::ceil((rect.x() + rect.width()) * scaleX) - 1, std::ceil((top + rect.height()) * scaleY) - 1);
+    return QRect(topLeft, bottomRight) & QRect(QPoint(), levelSize);
+}
+
+void ComputeKawaseBlurEngine::dispatch(GLTexture *read, GLTexture *write, GLenum format, const QRect &rect, const RegionUniforms &region)
+{
+    if (rect.isEmpty()) {
+        return;
+    }
+
+    read->bind();
+    glBindImageTexture(0, write->texture(), 0, GL_FALSE, 0, GL_WRITE_ONLY, format);
+    glUniform2i(region.offsetLocation, rect.x(), rect.y());
+    glUniform2i(region.sizeLocation, rect.width(), rect.height());
+    glDispatchCompute((rect.width() + s_workGroupSize - 1) / s_workGroupSize,
+                      (rect.height() + s_workGroupSize - 1) / s_workGroupSize,
+                      1);
+
+    // The next pass reads the result through a sampler.
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void ComputeKawaseBlurEngine::blur(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int vertexCount, const QRect &boundingRect, const QSize &backgroundSize, const QMatrix4x4 &colorMatrix)
+{
+    const GLenum format = renderInfo.textures[0]->internalFormat();
+    const Programs *programs = this->programs(format);
+    if (!programs) {
+        KawaseBlurEngine::blur(renderInfo, vbo, vertexCount, boundingRect, backgroundSize, colorMatrix);
+        return;
+    }
+
+    const auto &textures = renderInfo.textures;
+
+    // The programs aren't managed by ShaderManager, so the bound program has to be restored manually.
+    GLint previousProgram = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    glActiveTexture(GL_TEXTURE0);
+
+    glUseProgram(programs->downsample.program);
+    glUniform1f(programs->downsample.offsetLocation, float(offset()));
+    glUniformMatrix4fv(programs->downsample.colorMatrixLocation, 1, GL_FALSE, colorMatrix.constData());
+    glUniform1i(programs->downsample.transformColorsLocation, true);
+
+    for (size_t i = 1; i < textures.size(); ++i) {
+        const auto &read = textures[i - 1];
+        glUniform2f(programs->downsample.halfpixelLocation, 0.5 / read->width(), 0.5 / read->height());
+        dispatch(read.get(), textures[i].get(), format, levelRect(boundingRect, backgroundSize, textures[i]->size()), programs->downsample.region);
+
+        if (i == 1) {
+            glUniform1i(programs->downsample.transformColorsLocation, false);
+        }
+    }
+
+    // The last upsample pass is rendered on the screen in draw().
+    glUseProgram(programs->upsample.program);
+    glUniform1f(programs->upsample.offsetLocation, float(offset()));
+
+    for (size_t i = textures.size() - 1; i > 1; --i) {
+        const auto &read = textures[i];
+        glUniform2f(programs->upsample.halfpixelLocation, 0.5 / read->width(), 0.5 / read->height());
+        dispatch(read.get(), textures[i - 1].get(), format, levelRect(boundingRect, backgroundSize, textures[i - 1]->size()), programs->upsample.region);
+    }
+
+    glUseProgram(previousProgram);
+}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "kawaseblurengine.h"
+
+#include <optional>
+#include <unordered_map>
+
+namespace KWin
+{
+
+/**
+ * The dual Kawase algorithm with the intermediate downsample and upsample passes running as compute dispatches that
+ * write directly to the render targets. The final upsample pass, which draws on the screen, is the same as in
+ * KawaseBlurEngine.
+ *
+ * Requires OpenGL 4.3 or OpenGL ES 3.1. Falls back to the fragment shaders for texture formats that can't be used as
+ * images.
+ */
+class ComputeKawaseBlurEngine : public KawaseBlurEngine
+{
+public:
+    ComputeKawaseBlurEngine();
+    ~ComputeKawaseBlurEngine() override;
+
+    /**
+     * @return Whether the current OpenGL context supports compute shaders.
+     */
+    static bool isSupported();
+
+    void blur(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int vertexCount, const QRect &boundingRect, const QSize &backgroundSize, const QMatrix4x4 &colorMatrix) override;
+
+private:
+    /// The part of the render target written by a dispatch.
+    struct RegionUniforms
+    {
+        int offsetLocation;
+        int sizeLocation;
+    };
+
+    struct DownsampleProgram
+    {
+        GLuint program = 0;
+        int offsetLocation;
+        int halfpixelLocation;
+        int transformColorsLocation;
+        int colorMatrixLocation;
+        RegionUniforms region;
+    };
+
+    struct UpsampleProgram
+    {
+        GLuint program = 0;
+        int offsetLocation;
+        int halfpixelLocation;
+        RegionUniforms region;
+    };
+
+    struct Programs
+    {
+        DownsampleProgram downsample;
+        UpsampleProgram upsample;
+    };
+
+    /**
+     * @return The programs writing to images of the specified format, or nullptr if the format isn't supported or
+     * the programs failed to compile.
+     */
+    const Programs *programs(GLenum format);
+
+    /**
+     * Loads the program from the binary cache, or compiles it and stores it in the cache.
+     * @return The name of the program, or 0 if it failed to compile.
+     */
+    GLuint compileProgram(const QString &fileName, const QByteArray &imageFormat);
+
+    /**
+     * @return The texels of a level of the specified size covered by the rectangle, which is in the coordinates of the
+     * background.
+     */
+    static QRect levelRect(const QRect &rect, const QSize &backgroundSize, const QSize &levelSize);
+
+    /**
+     * Runs the bound program for the texels of the rectangle in the texture being written.
+     */
+    static void dispatch(GLTexture *read, GLTexture *write, GLenum format, const QRect &rect, const RegionUniforms &region);
+
+    // Formats for which the programs failed to compile are stored too, so that compilation isn't retried every frame.
+    std::unordered_map<GLenum, std::optional<Programs>> m_programs;
+};
+
+}
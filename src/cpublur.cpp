@@ -0,0 +1,543 @@
+#include "cpublur.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// AVX2 isn't part of the x86-64 baseline, the kernels are compiled for it separately and selected at runtime.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_BLUR_AVX2 1
+#define CPU_BLUR_AVX2_TARGET __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+namespace KWin
+{
+
+namespace
+{
+
+/// A pixel of an intermediate level, RGBA.
+struct alignas(16) Texel
+{
+    float channels[4];
+};
+
+#if defined(__SSE2__)
+using Vec4 = __m128;
+
+inline Vec4 load(const Texel &texel)
+{
+    return _mm_load_ps(texel.channels);
+}
+inline Vec4 loadBytes(const uchar *bytes)
+{
+    int word;
+    std::memcpy(&word, bytes, sizeof(word));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(word), zero);
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero)), _mm_set1_ps(1.0f / 255.0f));
+}
+inline void store(Texel &texel, Vec4 v)
+{
+    _mm_store_ps(texel.channels, v);
+}
+inline Vec4 splat(float f)
+{
+    return _mm_set1_ps(f);
+}
+inline Vec4 add(Vec4 a, Vec4 b)
+{
+    return _mm_add_ps(a, b);
+}
+inline Vec4 sub(Vec4 a, Vec4 b)
+{
+    return _mm_sub_ps(a, b);
+}
+inline Vec4 mul(Vec4 a, Vec4 b)
+{
+    return _mm_mul_ps(a, b);
+}
+#elif defined(__ARM_NEON)
+using Vec4 = float32x4_t;
+
+inline Vec4 load(const Texel &texel)
+{
+    return vld1q_f32(texel.channels);
+}
+inline Vec4 loadBytes(const uchar *bytes)
+{
+    uint32_t word;
+    std::memcpy(&word, bytes, sizeof(word));
+    const uint16x8_t words = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(word)));
+    return vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(words))), vdupq_n_f32(1.0f / 255.0f));
+}
+inline void store(Texel &texel, Vec4 v)
+{
+    vst1q_f32(texel.channels, v);
+}
+inline Vec4 splat(float f)
+{
+    return vdupq_n_f32(f);
+}
+inline Vec4 add(Vec4 a, Vec4 b)
+{
+    return vaddq_f32(a, b);
+}
+inline Vec4 sub(Vec4 a, Vec4 b)
+{
+    return vsubq_f32(a, b);
+}
+inline Vec4 mul(Vec4 a, Vec4 b)
+{
+    return vmulq_f32(a, b);
+}
+#else
+struct Vec4
+{
+    float v[4];
+};
+
+inline Vec4 load(const Texel &texel)
+{
+    return Vec4{{texel.channels[0], texel.channels[1], texel.channels[2], texel.channels[3]}};
+}
+inline Vec4 loadBytes(const uchar *bytes)
+{
+    return Vec4{{bytes[0] / 255.0f, bytes[1] / 255.0f, bytes[2] / 255.0f, bytes[3] / 255.0f}};
+}
+inline void store(Texel &texel, Vec4 v)
+{
+    std::copy(v.v, v.v + 4, texel.channels);
+}
+inline Vec4 splat(float f)
+{
+    return Vec4{{f, f, f, f}};
+}
+inline Vec4 add(Vec4 a, Vec4 b)
+{
+    return Vec4{{a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]}};
+}
+inline Vec4 sub(Vec4 a, Vec4 b)
+{
+    return Vec4{{a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]}};
+}
+inline Vec4 mul(Vec4 a, Vec4 b)
+{
+    return Vec4{{a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]}};
+}
+#endif
+
+inline Vec4 lerp(Vec4 a, Vec4 b, float t)
+{
+    return add(a, mul(sub(b, a), splat(t)));
+}
+
+/**
+ * The texels and weights read when sampling a level like a texture with GL_LINEAR filtering and GL_CLAMP_TO_EDGE
+ * wrapping.
+ */
+struct Tap
+{
+    Tap(int width, int height, float u, float v)
+    {
+        const float x = u * width - 0.5f;
+        const float y = v * height - 0.5f;
+        const float x0f = std::floor(x);
+        const float y0f = std::floor(y);
+        fx = x - x0f;
+        fy = y - y0f;
+
+        x0 = std::clamp(static_cast<int>(x0f), 0, width - 1);
+        x1 = std::clamp(static_cast<int>(x0f) + 1, 0, width - 1);
+        y0 = std::clamp(static_cast<int>(y0f), 0, height - 1);
+        y1 = std::clamp(static_cast<int>(y0f) + 1, 0, height - 1);
+    }
+
+    int x0, x1, y0, y1;
+    float fx, fy;
+};
+
+/**
+ * An intermediate level, stored as floats.
+ */
+struct FloatLevel
+{
+    FloatLevel(int width, int height)
+        : width(width)
+        , height(height)
+        , texels(static_cast<size_t>(width) * height)
+    {
+    }
+
+    const Texel &at(int x, int y) const
+    {
+        return texels[static_cast<size_t>(y) * width + x];
+    }
+
+    Texel &at(int x, int y)
+    {
+        return texels[static_cast<size_t>(y) * width + x];
+    }
+
+    Vec4 texel(int x, int y) const
+    {
+        return load(at(x, y));
+    }
+
+    void write(int x, int y, Vec4 color)
+    {
+        store(at(x, y), color);
+    }
+
+    int width;
+    int height;
+    std::vector<Texel> texels;
+};
+
+/**
+ * The source image, read directly instead of being converted into a float level first.
+ */
+struct ImageLevel
+{
+    explicit ImageLevel(const QImage &image)
+        : width(image.width())
+        , height(image.height())
+        , image(image)
+    {
+    }
+
+    const uchar *at(int x, int y) const
+    {
+        return image.constScanLine(y) + x * 4;
+    }
+
+    Vec4 texel(int x, int y) const
+    {
+        return loadBytes(at(x, y));
+    }
+
+    int width;
+    int height;
+    const QImage &image;
+};
+
+/**
+ * The blurred image, the last upsampling pass is written straight into it. Noise is added and the alpha channel is
+ * set to 1, like in the texture pass.
+ */
+struct ImageOutput
+{
+    ImageOutput(QImage &image, int noiseStrength)
+        : width(image.width())
+        , height(image.height())
+        , image(image)
+        , noiseStrength(noiseStrength)
+        , random(std::random_device{}())
+    {
+    }
+
+    uchar *at(int x, int y)
+    {
+        return image.scanLine(y) + x * 4;
+    }
+
+    float noise()
+    {
+        return noiseStrength > 0 ? (random() % noiseStrength) / 255.0f : 0.0f;
+    }
+
+    void write(int x, int y, Vec4 color)
+    {
+        Texel texel;
+        store(texel, color);
+
+        const float noise = this->noise();
+        uchar *pixel = at(x, y);
+        for (int c = 0; c < 3; c++) {
+            pixel[c] = static_cast<uchar>(std::clamp(texel.channels[c] + noise, 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+        pixel[3] = 255;
+    }
+
+    int width;
+    int height;
+    QImage &image;
+    int noiseStrength;
+    std::minstd_rand random;
+};
+
+template<typename Level>
+inline Vec4 sample(const Level &level, float u, float v)
+{
+    const Tap tap(level.width, level.height, u, v);
+    const Vec4 top = lerp(level.texel(tap.x0, tap.y0), level.texel(tap.x1, tap.y0), tap.fx);
+    const Vec4 bottom = lerp(level.texel(tap.x0, tap.y1), level.texel(tap.x1, tap.y1), tap.fx);
+    return lerp(top, bottom, tap.fy);
+}
+
+/**
+ * @see downsample.frag
+ */
+template<typename Level>
+inline Vec4 downsamplePixel(const Level &read, float u, float v, float dx, float dy)
+{
+    Vec4 sum = mul(sample(read, u, v), splat(4.0f));
+    sum = add(sum, sample(read, u - dx, v - dy));
+    sum = add(sum, sample(read, u + dx, v + dy));
+    sum = add(sum, sample(read, u + dx, v - dy));
+    sum = add(sum, sample(read, u - dx, v + dy));
+    return mul(sum, splat(1.0f / 8.0f));
+}
+
+/**
+ * @see upsample.glsl
+ */
+template<typename Level>
+inline Vec4 upsamplePixel(const Level &read, float u, float v, float dx, float dy)
+{
+    Vec4 sum = sample(read, u - dx * 2.0f, v);
+    sum = add(sum, sample(read, u, v + dy * 2.0f));
+    sum = add(sum, sample(read, u + dx * 2.0f, v));
+    sum = add(sum, sample(read, u, v - dy * 2.0f));
+
+    Vec4 diagonal = sample(read, u - dx, v + dy);
+    diagonal = add(diagonal, sample(read, u + dx, v + dy));
+    diagonal = add(diagonal, sample(read, u + dx, v - dy));
+    diagonal = add(diagonal, sample(read, u - dx, v - dy));
+
+    sum = add(sum, mul(diagonal, splat(2.0f)));
+    return mul(sum, splat(1.0f / 12.0f));
+}
+
+#ifdef CPU_BLUR_AVX2
+/*
+ * Two horizontally adjacent pixels are processed at once, one in each 128-bit lane. The operations are the same as in
+ * the SSE2 kernels, FMA isn't used, so that the results are identical.
+ */
+using Vec8 = __m256;
+
+CPU_BLUR_AVX2_TARGET inline Vec8 texelPair(const FloatLevel &level, int xa, int ya, int xb, int yb)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_load_ps(level.at(xa, ya).channels)), _mm_load_ps(level.at(xb, yb).channels), 1);
+}
+
+CPU_BLUR_AVX2_TARGET inline Vec8 texelPair(const ImageLevel &level, int xa, int ya, int xb, int yb)
+{
+    int a;
+    int b;
+    std::memcpy(&a, level.at(xa, ya), sizeof(a));
+    std::memcpy(&b, level.at(xb, yb), sizeof(b));
+    const __m256i channels = _mm256_cvtepu8_epi32(_mm_setr_epi32(a, b, 0, 0));
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(channels), _mm256_set1_ps(1.0f / 255.0f));
+}
+
+CPU_BLUR_AVX2_TARGET inline Vec8 lerp(Vec8 a, Vec8 b, Vec8 t)
+{
+    return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+}
+
+template<typename Level>
+CPU_BLUR_AVX2_TARGET inline Vec8 samplePair(const Level &level, float ua, float ub, float v)
+{
+    const Tap a(level.width, level.height, ua, v);
+    const Tap b(level.width, level.height, ub, v);
+    const Vec8 fx = _mm256_setr_ps(a.fx, a.fx, a.fx, a.fx, b.fx, b.fx, b.fx, b.fx);
+    const Vec8 fy = _mm256_setr_ps(a.fy, a.fy, a.fy, a.fy, b.fy, b.fy, b.fy, b.fy);
+
+    const Vec8 top = lerp(texelPair(level, a.x0, a.y0, b.x0, b.y0), texelPair(level, a.x1, a.y0, b.x1, b.y0), fx);
+    const Vec8 bottom = lerp(texelPair(level, a.x0, a.y1, b.x0, b.y1), texelPair(level, a.x1, a.y1, b.x1, b.y1), fx);
+    return lerp(top, bottom, fy);
+}
+
+CPU_BLUR_AVX2_TARGET inline void writePair(FloatLevel &level, int x, int y, Vec8 colors)
+{
+    // Both texels are next to each other.
+    _mm256_storeu_ps(level.at(x, y).channels, colors);
+}
+
+CPU_BLUR_AVX2_TARGET inline void writePair(ImageOutput &output, int x, int y, Vec8 colors)
+{
+    const float noiseA = output.noise();
+    const float noiseB = output.noise();
+    colors = _mm256_add_ps(colors, _mm256_setr_ps(noiseA, noiseA, noiseA, 0.0f, noiseB, noiseB, noiseB, 0.0f));
+    colors = _mm256_min_ps(_mm256_max_ps(colors, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+    const __m256i channels = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(colors, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
+
+    const __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(channels), _mm256_extracti128_si256(channels, 1));
+    const __m128i bytes = _mm_packus_epi16(words, words);
+    const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xff000000));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(output.at(x, y)), _mm_or_si128(bytes, opaque));
+}
+
+template<typename Level>
+CPU_BLUR_AVX2_TARGET void downsampleAvx2(const Level &read, FloatLevel &draw, float offset)
+{
+    const float dx = 0.5f / read.width * offset;
+    const float dy = 0.5f / read.height * offset;
+    const Vec8 centerWeight = _mm256_set1_ps(4.0f);
+    const Vec8 normalization = _mm256_set1_ps(1.0f / 8.0f);
+
+    for (int y = 0; y < draw.height; y++) {
+        const float v = (y + 0.5f) / draw.height;
+        int x = 0;
+        for (; x + 1 < draw.width; x += 2) {
+            const float ua = (x + 0.5f) / draw.width;
+            const float ub = (x + 1.5f) / draw.width;
+
+            Vec8 sum = _mm256_mul_ps(samplePair(read, ua, ub, v), centerWeight);
+            sum = _mm256_add_ps(sum, samplePair(read, ua - dx, ub - dx, v - dy));
+            sum = _mm256_add_ps(sum, samplePair(read, ua + dx, ub + dx, v + dy));
+            sum = _mm256_add_ps(sum, samplePair(read, ua + dx, ub + dx, v - dy));
+            sum = _mm256_add_ps(sum, samplePair(read, ua - dx, ub - dx, v + dy));
+            writePair(draw, x, y, _mm256_mul_ps(sum, normalization));
+        }
+        for (; x < draw.width; x++) {
+            draw.write(x, y, downsamplePixel(read, (x + 0.5f) / draw.width, v, dx, dy));
+        }
+    }
+}
+
+template<typename Output>
+CPU_BLUR_AVX2_TARGET void upsampleAvx2(const FloatLevel &read, Output &draw, float offset)
+{
+    const float dx = 0.5f / read.width * offset;
+    const float dy = 0.5f / read.height * offset;
+    const Vec8 diagonalWeight = _mm256_set1_ps(2.0f);
+    const Vec8 normalization = _mm256_set1_ps(1.0f / 12.0f);
+
+    for (int y = 0; y < draw.height; y++) {
+        const float v = (y + 0.5f) / draw.height;
+        int x = 0;
+        for (; x + 1 < draw.width; x += 2) {
+            const float ua = (x + 0.5f) / draw.width;
+            const float ub = (x + 1.5f) / draw.width;
+
+            Vec8 sum = samplePair(read, ua - dx * 2.0f, ub - dx * 2.0f, v);
+            sum = _mm256_add_ps(sum, samplePair(read, ua, ub, v + dy * 2.0f));
+            sum = _mm256_add_ps(sum, samplePair(read, ua + dx * 2.0f, ub + dx * 2.0f, v));
+            sum = _mm256_add_ps(sum, samplePair(read, ua, ub, v - dy * 2.0f));
+
+            Vec8 diagonal = samplePair(read, ua - dx, ub - dx, v + dy);
+            diagonal = _mm256_add_ps(diagonal, samplePair(read, ua + dx, ub + dx, v + dy));
+            diagonal = _mm256_add_ps(diagonal, samplePair(read, ua + dx, ub + dx, v - dy));
+            diagonal = _mm256_add_ps(diagonal, samplePair(read, ua - dx, ub - dx, v - dy));
+
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(diagonal, diagonalWeight));
+            writePair(draw, x, y, _mm256_mul_ps(sum, normalization));
+        }
+        for (; x < draw.width; x++) {
+            draw.write(x, y, upsamplePixel(read, (x + 0.5f) / draw.width, v, dx, dy));
+        }
+    }
+}
+
+bool hasAvx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+/**
+ * @see downsample.frag
+ */
+template<typename Level>
+void downsample(const Level &read, FloatLevel &draw, float offset)
+{
+#ifdef CPU_BLUR_AVX2
+    if (hasAvx2()) {
+        downsampleAvx2(read, draw, offset);
+        return;
+    }
+#endif
+
+    const float dx = 0.5f / read.width * offset;
+    const float dy = 0.5f / read.height * offset;
+    for (int y = 0; y < draw.height; y++) {
+        const float v = (y + 0.5f) / draw.height;
+        for (int x = 0; x < draw.width; x++) {
+            draw.write(x, y, downsamplePixel(read, (x + 0.5f) / draw.width, v, dx, dy));
+        }
+    }
+}
+
+/**
+ * @see upsample.glsl
+ */
+template<typename Output>
+void upsample(const FloatLevel &read, Output &draw, float offset)
+{
+#ifdef CPU_BLUR_AVX2
+    if (hasAvx2()) {
+        upsampleAvx2(read, draw, offset);
+        return;
+    }
+#endif
+
+    const float dx = 0.5f / read.width * offset;
+    const float dy = 0.5f / read.height * offset;
+    for (int y = 0; y < draw.height; y++) {
+        const float v = (y + 0.5f) / draw.height;
+        for (int x = 0; x < draw.width; x++) {
+            draw.write(x, y, upsamplePixel(read, (x + 0.5f) / draw.width, v, dx, dy));
+        }
+    }
+}
+
+}
+
+QImage cpuBlur(const QImage &image, const CpuBlurParameters &parameters)
+{
+    if (image.isNull()) {
+        return {};
+    }
+
+    const QImage source = image.convertToFormat(QImage::Format_RGBA8888_Premultiplied);
+    QImage blurred(source.size(), QImage::Format_RGBA8888_Premultiplied);
+    if (blurred.isNull()) {
+        return {};
+    }
+
+    const ImageLevel sourceLevel(source);
+    ImageOutput output(blurred, parameters.noiseStrength);
+    if (parameters.iterationCount == 0) {
+        for (int y = 0; y < source.height(); y++) {
+            for (int x = 0; x < source.width(); x++) {
+                output.write(x, y, sourceLevel.texel(x, y));
+            }
+        }
+        return blurred;
+    }
+
+    // The sizes of the levels are calculated the same way as in BlurEffect::blur. Only the levels between the source
+    // and the blurred image are stored as floats, they're at most a quarter of the size of the image.
+    std::vector<FloatLevel> levels;
+    levels.reserve(parameters.iterationCount);
+    for (size_t i = 1; i <= parameters.iterationCount; i++) {
+        const QSize size = (source.size() / (1 << i)).expandedTo(QSize(1, 1));
+        levels.emplace_back(size.width(), size.height());
+    }
+
+    downsample(sourceLevel, levels[0], parameters.offset);
+    for (size_t i = 1; i < levels.size(); i++) {
+        downsample(levels[i - 1], levels[i], parameters.offset);
+    }
+    for (size_t i = levels.size() - 1; i > 0; i--) {
+        upsample(levels[i], levels[i - 1], parameters.offset);
+    }
+
+    // The last upsampling pass is done straight into the image, see BlurEffect::blur.
+    upsample(levels[0], output, parameters.offset);
+    return blurred;
+}
+
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <QImage>
+
+namespace KWin
+{
+
+struct CpuBlurParameters
+{
+    size_t iterationCount;
+    float offset;
+    int noiseStrength;
+
+    bool operator==(const CpuBlurParameters &other) const = default;
+};
+
+/**
+ * Blurs the image on the CPU using the same dual Kawase kernels as downsample.frag and upsample.glsl, including the
+ * noise. The color matrix isn't applied, since the GPU applies it after transforming the image into the color space
+ * of the render target. Intermediate levels are stored as floats, so the result may differ from the GPU by the
+ * rounding of the render target format. Vectorized using SSE2 on x86-64 and NEON on ARM, both of which are always
+ * available on those architectures, and AVX2 on x86-64 CPUs that support it.
+ *
+ * Safe to call from any thread.
+ *
+ * @return The blurred image in QImage::Format_RGBA8888_Premultiplied, or a null image if the image is null.
+ */
+QImage cpuBlur(const QImage &image, const CpuBlurParameters &parameters);
+
+}
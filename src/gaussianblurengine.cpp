@@ -0,0 +1,208 @@
+#include "gaussianblurengine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace KWin
+{
+
+GaussianBlurEngine::GaussianBlurEngine()
+{
+    m_downsamplePass.shader = ShaderManager::instance()->generateShaderFromFile(ShaderTrait::MapTexture,
+                                                                                QStringLiteral(":/effects/forceblur/shaders/vertex.vert"),
+                                                                                QStringLiteral(":/effects/forceblur/shaders/gaussian_downsample.frag"));
+    if (!m_downsamplePass.shader) {
+        return;
+    }
+    m_downsamplePass.mvpMatrixLocation = m_downsamplePass.shader->uniformLocation("modelViewProjectionMatrix");
+    m_downsamplePass.transformColorsLocation = m_downsamplePass.shader->uniformLocation("transformColors");
+    m_downsamplePass.colorMatrixLocation = m_downsamplePass.shader->uniformLocation("colorMatrix");
+
+    m_gaussianPass.shader = ShaderManager::instance()->generateShaderFromFile(ShaderTrait::MapTexture,
+                                                                              QStringLiteral(":/effects/forceblur/shaders/vertex.vert"),
+                                                                              QStringLiteral(":/effects/forceblur/shaders/gaussian.frag"));
+    if (!m_gaussianPass.shader) {
+        return;
+    }
+    m_gaussianPass.mvpMatrixLocation = m_gaussianPass.shader->uniformLocation("modelViewProjectionMatrix");
+    m_gaussianPass.directionLocation = m_gaussianPass.shader->uniformLocation("direction");
+    m_gaussianPass.offsetsLocation = m_gaussianPass.shader->uniformLocation("offsets");
+    m_gaussianPass.weightsLocation = m_gaussianPass.shader->uniformLocation("weights");
+    m_gaussianPass.sampleCountLocation = m_gaussianPass.shader->uniformLocation("sampleCount");
+
+    m_upsamplePass.shader = ShaderManager::instance()->generateShaderFromFile(ShaderTrait::MapTexture,
+                                                                              QStringLiteral(":/effects/forceblur/shaders/vertex.vert"),
+                                                                              QStringLiteral(":/effects/forceblur/shaders/gaussian_upsample.frag"));
+    if (!m_upsamplePass.shader) {
+        return;
+    }
+    m_upsamplePass.mvpMatrixLocation = m_upsamplePass.shader->uniformLocation("modelViewProjectionMatrix");
+    m_upsamplePass.textureLocation = m_upsamplePass.shader->uniformLocation("texUnit");
+    m_upsamplePass.noiseLocation = m_upsamplePass.shader->uniformLocation("noise");
+    m_upsamplePass.noiseTextureLocation = m_upsamplePass.shader->uniformLocation("noiseTexture");
+    m_upsamplePass.noiseTextureSizeLocation = m_upsamplePass.shader->uniformLocation("noiseTextureSize");
+    m_upsamplePass.topCornerRadiusLocation = m_upsamplePass.shader->uniformLocation("topCornerRadius");
+    m_upsamplePass.bottomCornerRadiusLocation = m_upsamplePass.shader->uniformLocation("bottomCornerRadius");
+    m_upsamplePass.antialiasingLocation = m_upsamplePass.shader->uniformLocation("antialiasing");
+    m_upsamplePass.blurSizeLocation = m_upsamplePass.shader->uniformLocation("blurSize");
+    m_upsamplePass.blurRectLocation = m_upsamplePass.shader->uniformLocation("blurRect");
+    m_upsamplePass.opacityLocation = m_upsamplePass.shader->uniformLocation("opacity");
+
+    m_valid = true;
+}
+
+bool GaussianBlurEngine::isValid() const
+{
+    return m_valid;
+}
+
+void GaussianBlurEngine::setStrength(int strength)
+{
+    // Approximates the standard deviation of the dual Kawase blur at the same strength, so that switching engines
+    // doesn't change the look much. Unlike the Kawase offset table, the curve has no steps.
+    const float x = strength + 1;
+    setSigma(1.2f + 0.3f * x * x);
+}
+
+void GaussianBlurEngine::setSigma(float sigma)
+{
+    m_sigma = sigma;
+
+    // Scale the background down until the standard deviation is around 1.5-3 texels, the blur is then cheap while
+    // the result can still be scaled back up using bilinear filtering without visible blocks.
+    m_downsampleCount = std::clamp(static_cast<int>(std::floor(std::log2(sigma / 1.5f))), 1, 6);
+    const float texelSigma = sigma / (1 << m_downsampleCount);
+
+    const int radius = std::min(static_cast<int>(std::ceil(texelSigma * 3)), (s_maxSampleCount - 1) * 2);
+    std::vector<float> kernel(radius + 2, 0.0f);
+    float total = 0;
+    for (int i = 0; i <= radius; i++) {
+        kernel[i] = std::exp(-(i * i) / (2 * texelSigma * texelSigma));
+        total += i == 0 ? kernel[i] : kernel[i] * 2;
+    }
+
+    // Merge pairs of neighbouring samples into one bilinear sample placed between them according to their weights.
+    m_offsets[0] = 0;
+    m_weights[0] = kernel[0] / total;
+    m_sampleCount = 1;
+    for (int i = 1; i <= radius; i += 2) {
+        const float weight = kernel[i] + kernel[i + 1];
+        m_offsets[m_sampleCount] = (i * kernel[i] + (i + 1) * kernel[i + 1]) / weight;
+        m_weights[m_sampleCount] = weight / total;
+        m_sampleCount++;
+    }
+}
+
+int GaussianBlurEngine::expandSize() const
+{
+    // The kernel reaches 3 standard deviations, every downsampling pass one more texel of its level.
+    return static_cast<int>(std::ceil(m_sigma * 3)) + (1 << m_downsampleCount);
+}
+
+std::vector<BlurRenderTarget> GaussianBlurEngine::renderTargets(const QSize &backgroundSize) const
+{
+    // The background and every downsampled level, followed by an intermediate target for the horizontal pass.
+    std::vector<BlurRenderTarget> renderTargets;
+    renderTargets.reserve(m_downsampleCount + 2);
+    for (int i = 0; i <= m_downsampleCount; ++i) {
+        renderTargets.push_back({backgroundSize / (1 << i)});
+    }
+    renderTargets.push_back(renderTargets.back());
+    return renderTargets;
+}
+
+int GaussianBlurEngine::blurPassCount() const
+{
+    return m_downsampleCount + 2;
+}
+
+void GaussianBlurEngine::blur(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int vertexCount, const QRect &boundingRect, const QSize &backgroundSize, const QMatrix4x4 &colorMatrix)
+{
+    QMatrix4x4 projectionMatrix;
+    projectionMatrix.ortho(QRectF(0.0, 0.0, backgroundSize.width(), backgroundSize.height()));
+
+    {
+        ShaderManager::instance()->pushShader(m_downsamplePass.shader.get());
+
+        m_downsamplePass.shader->setUniform(m_downsamplePass.mvpMatrixLocation, projectionMatrix);
+        m_downsamplePass.shader->setUniform(m_downsamplePass.colorMatrixLocation, colorMatrix);
+        m_downsamplePass.shader->setUniform(m_downsamplePass.transformColorsLocation, true);
+
+        for (int i = 1; i <= m_downsampleCount; ++i) {
+            renderInfo.textures[i - 1]->bind();
+
+            GLFramebuffer::pushFramebuffer(renderInfo.framebuffers[i].get());
+            vbo->draw(GL_TRIANGLES, 0, vertexCount);
+            GLFramebuffer::popFramebuffer();
+
+            if (i == 1) {
+                m_downsamplePass.shader->setUniform(m_downsamplePass.transformColorsLocation, false);
+            }
+        }
+
+        ShaderManager::instance()->popShader();
+    }
+
+    ShaderManager::instance()->pushShader(m_gaussianPass.shader.get());
+
+    m_gaussianPass.shader->setUniform(m_gaussianPass.mvpMatrixLocation, projectionMatrix);
+    glUniform1fv(m_gaussianPass.offsetsLocation, s_maxSampleCount, m_offsets.data());
+    glUniform1fv(m_gaussianPass.weightsLocation, s_maxSampleCount, m_weights.data());
+    glUniform1i(m_gaussianPass.sampleCountLocation, m_sampleCount);
+
+    const auto &level = renderInfo.textures[m_downsampleCount];
+    const auto &intermediate = renderInfo.textures[m_downsampleCount + 1];
+
+    // Horizontal pass, from the smallest level into the intermediate target.
+    m_gaussianPass.shader->setUniform(m_gaussianPass.directionLocation, QVector2D(1.0 / level->width(), 0.0));
+    level->bind();
+    GLFramebuffer::pushFramebuffer(renderInfo.framebuffers[m_downsampleCount + 1].get());
+    vbo->draw(GL_TRIANGLES, 0, vertexCount);
+    GLFramebuffer::popFramebuffer();
+
+    // Vertical pass, back into the smallest level.
+    m_gaussianPass.shader->setUniform(m_gaussianPass.directionLocation, QVector2D(0.0, 1.0 / intermediate->height()));
+    intermediate->bind();
+    GLFramebuffer::pushFramebuffer(renderInfo.framebuffers[m_downsampleCount].get());
+    vbo->draw(GL_TRIANGLES, 0, vertexCount);
+    GLFramebuffer::popFramebuffer();
+
+    ShaderManager::instance()->popShader();
+}
+
+void GaussianBlurEngine::draw(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int first, int count, const BlurDrawParameters &parameters)
+{
+    ShaderManager::instance()->pushShader(m_upsamplePass.shader.get());
+
+    m_upsamplePass.shader->setUniform(m_upsamplePass.noiseLocation, parameters.noiseTexture != nullptr);
+    if (parameters.noiseTexture) {
+        m_upsamplePass.shader->setUniform(m_upsamplePass.noiseTextureSizeLocation, QVector2D(parameters.noiseTexture->width(), parameters.noiseTexture->height()));
+
+        glUniform1i(m_upsamplePass.noiseTextureLocation, 1);
+        glActiveTexture(GL_TEXTURE1);
+        parameters.noiseTexture->bind();
+    }
+
+    glUniform1i(m_upsamplePass.textureLocation, 0);
+    glActiveTexture(GL_TEXTURE0);
+    renderInfo.textures[m_downsampleCount]->bind();
+
+    m_upsamplePass.shader->setUniform(m_upsamplePass.topCornerRadiusLocation, parameters.topCornerRadius);
+    m_upsamplePass.shader->setUniform(m_upsamplePass.bottomCornerRadiusLocation, parameters.bottomCornerRadius);
+    m_upsamplePass.shader->setUniform(m_upsamplePass.antialiasingLocation, parameters.antialiasing);
+    m_upsamplePass.shader->setUniform(m_upsamplePass.blurSizeLocation, QVector2D(parameters.blurSize.width(), parameters.blurSize.height()));
+    m_upsamplePass.shader->setUniform(m_upsamplePass.blurRectLocation, QVector4D(parameters.blurRect.x(), parameters.blurRect.y(), parameters.blurRect.width(), parameters.blurRect.height()));
+    m_upsamplePass.shader->setUniform(m_upsamplePass.opacityLocation, parameters.opacity);
+    m_upsamplePass.shader->setUniform(m_upsamplePass.mvpMatrixLocation, parameters.projectionMatrix);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    vbo->draw(GL_TRIANGLES, first, count);
+
+    glDisable(GL_BLEND);
+    ShaderManager::instance()->popShader();
+}
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "blurengine.h"
+
+#include <array>
+
+namespace KWin
+{
+
+/**
+ * Scales the background down by a power of two and applies a separable Gaussian blur at the reduced resolution. The
+ * radius is continuous, any standard deviation can be used.
+ */
+class GaussianBlurEngine : public BlurEngine
+{
+public:
+    GaussianBlurEngine();
+
+    bool isValid() const override;
+    void setStrength(int strength) override;
+    int expandSize() const override;
+    std::vector<BlurRenderTarget> renderTargets(const QSize &backgroundSize) const override;
+    int blurPassCount() const override;
+    void blur(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int vertexCount, const QRect &boundingRect, const QSize &backgroundSize, const QMatrix4x4 &colorMatrix) override;
+    void draw(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int first, int count, const BlurDrawParameters &parameters) override;
+
+    /**
+     * @param sigma The standard deviation of the blur in logical pixels.
+     */
+    void setSigma(float sigma);
+
+private:
+    // Must match the size of the arrays in gaussian.frag.
+    static constexpr int s_maxSampleCount = 8;
+
+    struct
+    {
+        std::unique_ptr<GLShader> shader;
+        int mvpMatrixLocation;
+        int transformColorsLocation;
+        int colorMatrixLocation;
+    } m_downsamplePass;
+
+    struct
+    {
+        std::unique_ptr<GLShader> shader;
+        int mvpMatrixLocation;
+        int directionLocation;
+        int offsetsLocation;
+        int weightsLocation;
+        int sampleCountLocation;
+    } m_gaussianPass;
+
+    struct
+    {
+        std::unique_ptr<GLShader> shader;
+        int mvpMatrixLocation;
+        int textureLocation;
+
+        int noiseLocation;
+        int noiseTextureLocation;
+        int noiseTextureSizeLocation;
+
+        int topCornerRadiusLocation;
+        int bottomCornerRadiusLocation;
+        int antialiasingLocation;
+        int blurSizeLocation;
+        int blurRectLocation;
+        int opacityLocation;
+    } m_upsamplePass;
+
+    bool m_valid = false;
+
+    float m_sigma = 0;
+    int m_downsampleCount = 1;
+    int m_sampleCount = 1;
+    std::array<float, s_maxSampleCount> m_offsets{};
+    std::array<float, s_maxSampleCount> m_weights{};
+};
+
+}
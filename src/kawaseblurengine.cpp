@@ -0,0 +1,271 @@
+#include "kawaseblurengine.h"
+
+#include <cmath>
+
+namespace KWin
+{
+
+KawaseBlurEngine::KawaseBlurEngine(KawaseKernel kernel)
+{
+    const bool fetchOptimized = kernel == KawaseKernel::FetchOptimized;
+    if (!loadDownsamplePass(m_downsamplePass, fetchOptimized
+            ? QStringLiteral(":/effects/forceblur/shaders/downsample_fast.frag")
+            : QStringLiteral(":/effects/forceblur/shaders/downsample.frag"))) {
+        return;
+    }
+    if (!loadUpsamplePass(m_upsamplePass, fetchOptimized
+            ? QStringLiteral(":/effects/forceblur/shaders/upsample_fast.frag")
+            : QStringLiteral(":/effects/forceblur/shaders/upsample.frag"))) {
+        return;
+    }
+
+    initBlurStrengthValues();
+    m_valid = true;
+}
+
+KawaseBlurEngine::~KawaseBlurEngine()
+{
+    glDeleteProgram(m_downsamplePass.program);
+    glDeleteProgram(m_upsamplePass.program);
+}
+
+bool KawaseBlurEngine::loadDownsamplePass(DownsamplePass &pass, const QString &fragmentShader)
+{
+    pass.program = m_binaryCache.buildProgram(QStringLiteral(":/effects/forceblur/shaders/vertex.vert"), fragmentShader);
+    if (!pass.program) {
+        return false;
+    }
+
+    pass.mvpMatrixLocation = glGetUniformLocation(pass.program, "modelViewProjectionMatrix");
+    pass.offsetLocation = glGetUniformLocation(pass.program, "offset");
+    pass.halfpixelLocation = glGetUniformLocation(pass.program, "halfpixel");
+    pass.transformColorsLocation = glGetUniformLocation(pass.program, "transformColors");
+    pass.colorMatrixLocation = glGetUniformLocation(pass.program, "colorMatrix");
+    return true;
+}
+
+bool KawaseBlurEngine::loadUpsamplePass(UpsamplePass &pass, const QString &fragmentShader)
+{
+    pass.program = m_binaryCache.buildProgram(QStringLiteral(":/effects/forceblur/shaders/vertex.vert"), fragmentShader);
+    if (!pass.program) {
+        return false;
+    }
+
+    pass.mvpMatrixLocation = glGetUniformLocation(pass.program, "modelViewProjectionMatrix");
+    pass.offsetLocation = glGetUniformLocation(pass.program, "offset");
+    pass.halfpixelLocation = glGetUniformLocation(pass.program, "halfpixel");
+    pass.textureLocation = glGetUniformLocation(pass.program, "texUnit");
+    pass.noiseLocation = glGetUniformLocation(pass.program, "noise");
+    pass.noiseTextureLocation = glGetUniformLocation(pass.program, "noiseTexture");
+    pass.noiseTextureSizeLocation = glGetUniformLocation(pass.program, "noiseTextureSize");
+    pass.topCornerRadiusLocation = glGetUniformLocation(pass.program, "topCornerRadius");
+    pass.bottomCornerRadiusLocation = glGetUniformLocation(pass.program, "bottomCornerRadius");
+    pass.antialiasingLocation = glGetUniformLocation(pass.program, "antialiasing");
+    pass.blurSizeLocation = glGetUniformLocation(pass.program, "blurSize");
+    pass.blurRectLocation = glGetUniformLocation(pass.program, "blurRect");
+    pass.opacityLocation = glGetUniformLocation(pass.program, "opacity");
+    return true;
+}
+
+void KawaseBlurEngine::initBlurStrengthValues()
+{
+    // This function creates an array of blur strength values that are evenly distributed
+
+    // The range of the slider on the blur settings UI
+    int numOfBlurSteps = 15;
+    int remainingSteps = numOfBlurSteps;
+
+    /*
+     * Explanation for these numbers:
+     *
+     * The texture blur amount depends on the downsampling iterations and the offset value.
+     * By changing the offset we can alter the blur amount without relying on further downsampling.
+     * But there is a minimum and maximum value of offset per downsample iteration before we
+     * get artifacts.
+     *
+     * The minOffset variable is the minimum offset value for an iteration before we
+     * get blocky artifacts because of the downsampling.
+     *
+     * The maxOffset value is the maximum offset value for an iteration before we
+     * get diagonal line artifacts because of the nature of the dual kawase blur algorithm.
+     *
+     * The expandSize value is the minimum value for an iteration before we reach the end
+     * of a texture in the shader and sample outside of the area that was copied into the
+     * texture from the screen.
+     */
+
+    // {minOffset, maxOffset, expandSize}
+    blurOffsets.append({1.0, 2.0, 10}); // Down sample size / 2
+    blurOffsets.append({2.0, 3.0, 20}); // Down sample size / 4
+    blurOffsets.append({2.0, 5.0, 50}); // Down sample size / 8
+    blurOffsets.append({3.0, 8.0, 150}); // Down sample size / 16
+    // blurOffsets.append({5.0, 10.0, 400}); // Down sample size / 32
+    // blurOffsets.append({7.0, ?.0});       // Down sample size / 64
+
+    float offsetSum = 0;
+
+    for (int i = 0; i < blurOffsets.size(); i++) {
+        offsetSum += blurOffsets[i].maxOffset - blurOffsets[i].minOffset;
+    }
+
+    for (int i = 0; i < blurOffsets.size(); i++) {
+        int iterationNumber = std::ceil((blurOffsets[i].maxOffset - blurOffsets[i].minOffset) / offsetSum * numOfBlurSteps);
+        remainingSteps -= iterationNumber;
+
+        if (remainingSteps < 0) {
+            iterationNumber += remainingSteps;
+        }
+
+        float offsetDifference = blurOffsets[i].maxOffset - blurOffsets[i].minOffset;
+
+        for (int j = 1; j <= iterationNumber; j++) {
+            // {iteration, offset}
+            blurStrengthValues.append({i + 1, blurOffsets[i].minOffset + (offsetDifference / iterationNumber) * j});
+        }
+    }
+}
+
+bool KawaseBlurEngine::isValid() const
+{
+    return m_valid;
+}
+
+void KawaseBlurEngine::setStrength(int strength)
+{
+    m_iterationCount = blurStrengthValues[strength].iteration;
+    m_offset = blurStrengthValues[strength].offset;
+    m_expandSize = blurOffsets[m_iterationCount - 1].expandSize;
+}
+
+int KawaseBlurEngine::expandSize() const
+{
+    return m_expandSize;
+}
+
+size_t KawaseBlurEngine::iterationCount() const
+{
+    return m_iterationCount;
+}
+
+int KawaseBlurEngine::offset() const
+{
+    return m_offset;
+}
+
+std::vector<BlurRenderTarget> KawaseBlurEngine::renderTargets(const QSize &backgroundSize) const
+{
+    std::vector<BlurRenderTarget> renderTargets;
+    renderTargets.reserve(m_iterationCount + 1);
+    for (size_t i = 0; i <= m_iterationCount; ++i) {
+        renderTargets.push_back({backgroundSize / (1 << i)});
+    }
+    return renderTargets;
+}
+
+int KawaseBlurEngine::blurPassCount() const
+{
+    // The last upsample pass is run by draw().
+    return static_cast<int>(m_iterationCount) * 2 - 1;
+}
+
+void KawaseBlurEngine::blur(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int vertexCount, const QRect &boundingRect, const QSize &backgroundSize, const QMatrix4x4 &colorMatrix)
+{
+    QMatrix4x4 projectionMatrix;
+    projectionMatrix.ortho(QRectF(0.0, 0.0, backgroundSize.width(), backgroundSize.height()));
+
+    // The programs aren't managed by ShaderManager, so the bound program has to be restored manually.
+    GLint previousProgram = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+    // The downsample pass of the dual Kawase algorithm: the background will be scaled down 50% every iteration.
+    {
+        glUseProgram(m_downsamplePass.program);
+
+        glUniformMatrix4fv(m_downsamplePass.mvpMatrixLocation, 1, GL_FALSE, projectionMatrix.constData());
+        glUniform1f(m_downsamplePass.offsetLocation, float(m_offset));
+        glUniformMatrix4fv(m_downsamplePass.colorMatrixLocation, 1, GL_FALSE, colorMatrix.constData());
+        glUniform1i(m_downsamplePass.transformColorsLocation, true);
+
+        for (size_t i = 1; i < renderInfo.framebuffers.size(); ++i) {
+            const auto &read = renderInfo.framebuffers[i - 1];
+            const auto &draw = renderInfo.framebuffers[i];
+
+            glUniform2f(m_downsamplePass.halfpixelLocation, 0.5 / read->colorAttachment()->width(), 0.5 / read->colorAttachment()->height());
+
+            read->colorAttachment()->bind();
+
+            GLFramebuffer::pushFramebuffer(draw.get());
+            vbo->draw(GL_TRIANGLES, 0, vertexCount);
+
+            if (i == 1) {
+                glUniform1i(m_downsamplePass.transformColorsLocation, false);
+            }
+        }
+    }
+
+    // The upsample pass of the dual Kawase algorithm: the background will be scaled up 200% every iteration. The
+    // last pass is rendered on the screen in draw().
+    glUseProgram(m_upsamplePass.program);
+
+    glUniform1f(m_upsamplePass.topCornerRadiusLocation, 0);
+    glUniform1f(m_upsamplePass.bottomCornerRadiusLocation, 0);
+    glUniformMatrix4fv(m_upsamplePass.mvpMatrixLocation, 1, GL_FALSE, projectionMatrix.constData());
+    glUniform1i(m_upsamplePass.noiseLocation, false);
+    glUniform1f(m_upsamplePass.offsetLocation, float(m_offset));
+
+    for (size_t i = renderInfo.framebuffers.size() - 1; i > 1; --i) {
+        GLFramebuffer::popFramebuffer();
+        const auto &read = renderInfo.framebuffers[i];
+
+        glUniform2f(m_upsamplePass.halfpixelLocation, 0.5 / read->colorAttachment()->width(), 0.5 / read->colorAttachment()->height());
+
+        read->colorAttachment()->bind();
+
+        vbo->draw(GL_TRIANGLES, 0, vertexCount);
+    }
+
+    GLFramebuffer::popFramebuffer();
+    glUseProgram(previousProgram);
+}
+
+void KawaseBlurEngine::draw(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int first, int count, const BlurDrawParameters &parameters)
+{
+    GLint previousProgram = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    glUseProgram(m_upsamplePass.program);
+
+    const auto &read = renderInfo.framebuffers[1];
+
+    glUniform1i(m_upsamplePass.noiseLocation, parameters.noiseTexture != nullptr);
+    if (parameters.noiseTexture) {
+        glUniform2f(m_upsamplePass.noiseTextureSizeLocation, parameters.noiseTexture->width(), parameters.noiseTexture->height());
+
+        glUniform1i(m_upsamplePass.noiseTextureLocation, 1);
+        glActiveTexture(GL_TEXTURE1);
+        parameters.noiseTexture->bind();
+    }
+
+    glUniform1i(m_upsamplePass.textureLocation, 0);
+    glActiveTexture(GL_TEXTURE0);
+    read->colorAttachment()->bind();
+
+    glUniform1f(m_upsamplePass.offsetLocation, float(m_offset));
+    glUniform1f(m_upsamplePass.topCornerRadiusLocation, parameters.topCornerRadius);
+    glUniform1f(m_upsamplePass.bottomCornerRadiusLocation, parameters.bottomCornerRadius);
+    glUniform1f(m_upsamplePass.antialiasingLocation, parameters.antialiasing);
+    glUniform2f(m_upsamplePass.blurSizeLocation, parameters.blurSize.width(), parameters.blurSize.height());
+    glUniform4f(m_upsamplePass.blurRectLocation, parameters.blurRect.x(), parameters.blurRect.y(), parameters.blurRect.width(), parameters.blurRect.height());
+    glUniform1f(m_upsamplePass.opacityLocation, parameters.opacity);
+    glUniformMatrix4fv(m_upsamplePass.mvpMatrixLocation, 1, GL_FALSE, parameters.projectionMatrix.constData());
+    glUniform2f(m_upsamplePass.halfpixelLocation, 0.5 / read->colorAttachment()->width(), 0.5 / read->colorAttachment()->height());
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    vbo->draw(GL_TRIANGLES, first, count);
+
+    glDisable(GL_BLEND);
+    glUseProgram(previousProgram);
+}
+
+}
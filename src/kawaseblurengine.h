@@ -0,0 +1,103 @@
+#pragma once
+
+#include "blurengine.h"
+#include "programbinarycache.h"
+#include "settings.h"
+
+#include <QList>
+
+namespace KWin
+{
+
+/**
+ * The dual Kawase algorithm. The background is scaled down 50% and back up in every iteration, the blur strength is
+ * quantized to the steps of the offset table.
+ *
+ * The programs are loaded from ProgramBinaryCache, so they aren't managed by ShaderManager.
+ */
+class KawaseBlurEngine : public BlurEngine
+{
+public:
+    explicit KawaseBlurEngine(KawaseKernel kernel);
+    ~KawaseBlurEngine() override;
+
+    bool isValid() const override;
+    void setStrength(int strength) override;
+    int expandSize() const override;
+    std::vector<BlurRenderTarget> renderTargets(const QSize &backgroundSize) const override;
+    int blurPassCount() const override;
+    void blur(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int vertexCount, const QRect &boundingRect, const QSize &backgroundSize, const QMatrix4x4 &colorMatrix) override;
+    void draw(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int first, int count, const BlurDrawParameters &parameters) override;
+
+    size_t iterationCount() const;
+    int offset() const;
+
+protected:
+    ProgramBinaryCache m_binaryCache;
+
+private:
+    struct DownsamplePass
+    {
+        GLuint program = 0;
+        int mvpMatrixLocation;
+        int offsetLocation;
+        int halfpixelLocation;
+        int transformColorsLocation;
+        int colorMatrixLocation;
+    };
+
+    struct UpsamplePass
+    {
+        GLuint program = 0;
+        int mvpMatrixLocation;
+        int offsetLocation;
+        int halfpixelLocation;
+        int textureLocation;
+
+        int noiseLocation;
+        int noiseTextureLocation;
+        int noiseTextureSizeLocation;
+
+        int topCornerRadiusLocation;
+        int bottomCornerRadiusLocation;
+        int antialiasingLocation;
+        int blurSizeLocation;
+        int blurRectLocation;
+        int opacityLocation;
+    };
+
+    /**
+     * @return Whether the program was loaded.
+     */
+    bool loadDownsamplePass(DownsamplePass &pass, const QString &fragmentShader);
+    bool loadUpsamplePass(UpsamplePass &pass, const QString &fragmentShader);
+
+    void initBlurStrengthValues();
+
+    DownsamplePass m_downsamplePass;
+    UpsamplePass m_upsamplePass;
+    bool m_valid = false;
+
+    size_t m_iterationCount = 1; // number of times the texture will be downsized to half size
+    int m_offset = 1;
+    int m_expandSize = 10;
+
+    struct OffsetStruct
+    {
+        float minOffset;
+        float maxOffset;
+        int expandSize;
+    };
+
+    QList<OffsetStruct> blurOffsets;
+
+    struct BlurValuesStruct
+    {
+        int iteration;
+        float offset;
+    };
+
+    QList<BlurValuesStruct> blurStrengthValues;
+};
+
+}
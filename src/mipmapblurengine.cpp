@@ -0,0 +1,152 @@
+#include "mipmapblurengine.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace KWin
+{
+
+MipmapBlurEngine::MipmapBlurEngine()
+{
+    // The background is scaled down with the same single sample pass as in the Gaussian engine.
+    m_downsamplePass.shader = ShaderManager::instance()->generateShaderFromFile(ShaderTrait::MapTexture,
+                                                                                QStringLiteral(":/effects/forceblur/shaders/vertex.vert"),
+                                                                                QStringLiteral(":/effects/forceblur/shaders/gaussian_downsample.frag"));
+    if (!m_downsamplePass.shader) {
+        return;
+    }
+    m_downsamplePass.mvpMatrixLocation = m_downsamplePass.shader->uniformLocation("modelViewProjectionMatrix");
+    m_downsamplePass.transformColorsLocation = m_downsamplePass.shader->uniformLocation("transformColors");
+    m_downsamplePass.colorMatrixLocation = m_downsamplePass.shader->uniformLocation("colorMatrix");
+
+    m_upsamplePass.shader = ShaderManager::instance()->generateShaderFromFile(ShaderTrait::MapTexture,
+                                                                              QStringLiteral(":/effects/forceblur/shaders/vertex.vert"),
+                                                                              QStringLiteral(":/effects/forceblur/shaders/mipmap_upsample.frag"));
+    if (!m_upsamplePass.shader) {
+        return;
+    }
+    m_upsamplePass.mvpMatrixLocation = m_upsamplePass.shader->uniformLocation("modelViewProjectionMatrix");
+    m_upsamplePass.textureLocation = m_upsamplePass.shader->uniformLocation("texUnit");
+    m_upsamplePass.biasLocation = m_upsamplePass.shader->uniformLocation("bias");
+    m_upsamplePass.halfpixelLocation = m_upsamplePass.shader->uniformLocation("halfpixel");
+    m_upsamplePass.noiseLocation = m_upsamplePass.shader->uniformLocation("noise");
+    m_upsamplePass.noiseTextureLocation = m_upsamplePass.shader->uniformLocation("noiseTexture");
+    m_upsamplePass.noiseTextureSizeLocation = m_upsamplePass.shader->uniformLocation("noiseTextureSize");
+    m_upsamplePass.topCornerRadiusLocation = m_upsamplePass.shader->uniformLocation("topCornerRadius");
+    m_upsamplePass.bottomCornerRadiusLocation = m_upsamplePass.shader->uniformLocation("bottomCornerRadius");
+    m_upsamplePass.antialiasingLocation = m_upsamplePass.shader->uniformLocation("antialiasing");
+    m_upsamplePass.blurSizeLocation = m_upsamplePass.shader->uniformLocation("blurSize");
+    m_upsamplePass.blurRectLocation = m_upsamplePass.shader->uniformLocation("blurRect");
+    m_upsamplePass.opacityLocation = m_upsamplePass.shader->uniformLocation("opacity");
+
+    m_valid = true;
+}
+
+bool MipmapBlurEngine::isValid() const
+{
+    return m_valid;
+}
+
+void MipmapBlurEngine::setStrength(int strength)
+{
+    // Same curve as in the Gaussian engine.
+    const float x = strength + 1;
+    setSigma(1.2f + 0.3f * x * x);
+}
+
+void MipmapBlurEngine::setSigma(float sigma)
+{
+    // A texel of level L of the half size texture covers 2^(L + 1) logical pixels. Together with trilinear filtering
+    // and the smoothing samples, the blur is roughly as wide as a Gaussian blur with a standard deviation of 1/2 of that.
+    m_level = std::max(0.0f, std::log2(sigma));
+}
+
+int MipmapBlurEngine::expandSize() const
+{
+    // The smoothing samples and filtering reach less than 2 texels of the next level, which covers 2^(L + 2) logical
+    // pixels.
+    return (1 << (static_cast<int>(std::ceil(m_level)) + 2)) + 2;
+}
+
+std::vector<BlurRenderTarget> MipmapBlurEngine::renderTargets(const QSize &backgroundSize) const
+{
+    return {
+        {backgroundSize},
+        {backgroundSize / 2, true},
+    };
+}
+
+int MipmapBlurEngine::blurPassCount() const
+{
+    // Downsampling and generating the mipmaps.
+    return 2;
+}
+
+void MipmapBlurEngine::blur(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int vertexCount, const QRect &boundingRect, const QSize &backgroundSize, const QMatrix4x4 &colorMatrix)
+{
+    QMatrix4x4 projectionMatrix;
+    projectionMatrix.ortho(QRectF(0.0, 0.0, backgroundSize.width(), backgroundSize.height()));
+
+    ShaderManager::instance()->pushShader(m_downsamplePass.shader.get());
+
+    m_downsamplePass.shader->setUniform(m_downsamplePass.mvpMatrixLocation, projectionMatrix);
+    m_downsamplePass.shader->setUniform(m_downsamplePass.colorMatrixLocation, colorMatrix);
+    m_downsamplePass.shader->setUniform(m_downsamplePass.transformColorsLocation, true);
+
+    renderInfo.textures[0]->bind();
+    GLFramebuffer::pushFramebuffer(renderInfo.framebuffers[1].get());
+    vbo->draw(GL_TRIANGLES, 0, vertexCount);
+    GLFramebuffer::popFramebuffer();
+
+    ShaderManager::instance()->popShader();
+
+    // The whole chain is regenerated, but all levels together are a third of the size of the downsampled background.
+    renderInfo.textures[1]->bind();
+    glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+void MipmapBlurEngine::draw(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int first, int count, const BlurDrawParameters &parameters)
+{
+    ShaderManager::instance()->pushShader(m_upsamplePass.shader.get());
+
+    const auto &texture = renderInfo.textures[1];
+
+    m_upsamplePass.shader->setUniform(m_upsamplePass.noiseLocation, parameters.noiseTexture != nullptr);
+    if (parameters.noiseTexture) {
+        m_upsamplePass.shader->setUniform(m_upsamplePass.noiseTextureSizeLocation, QVector2D(parameters.noiseTexture->width(), parameters.noiseTexture->height()));
+
+        glUniform1i(m_upsamplePass.noiseTextureLocation, 1);
+        glActiveTexture(GL_TEXTURE1);
+        parameters.noiseTexture->bind();
+    }
+
+    glUniform1i(m_upsamplePass.textureLocation, 0);
+    glActiveTexture(GL_TEXTURE0);
+    texture->bind();
+
+    // Without the bias, the GPU would pick a level of detail of -1 - log2(scale), because every texel of the
+    // downsampled background covers 2 * scale device pixels.
+    m_upsamplePass.shader->setUniform(m_upsamplePass.biasLocation, static_cast<float>(m_level + 1 + std::log2(parameters.scale)));
+
+    const float texelSize = std::exp2(m_level);
+    m_upsamplePass.shader->setUniform(m_upsamplePass.halfpixelLocation, QVector2D(0.5 * texelSize / texture->width(),
+                                                                                    0.5 * texelSize / texture->height()));
+
+    m_upsamplePass.shader->setUniform(m_upsamplePass.topCornerRadiusLocation, parameters.topCornerRadius);
+    m_upsamplePass.shader->setUniform(m_upsamplePass.bottomCornerRadiusLocation, parameters.bottomCornerRadius);
+    m_upsamplePass.shader->setUniform(m_upsamplePass.antialiasingLocation, parameters.antialiasing);
+    m_upsamplePass.shader->setUniform(m_upsamplePass.blurSizeLocation, QVector2D(parameters.blurSize.width(), parameters.blurSize.height()));
+    m_upsamplePass.shader->setUniform(m_upsamplePass.blurRectLocation, QVector4D(parameters.blurRect.x(), parameters.blurRect.y(), parameters.blurRect.width(), parameters.blurRect.height()));
+    m_upsamplePass.shader->setUniform(m_upsamplePass.opacityLocation, parameters.opacity);
+    m_upsamplePass.shader->setUniform(m_upsamplePass.mvpMatrixLocation, parameters.projectionMatrix);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    vbo->draw(GL_TRIANGLES, first, count);
+
+    glDisable(GL_BLEND);
+    ShaderManager::instance()->popShader();
+}
+
+}
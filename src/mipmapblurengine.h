@@ -0,0 +1,65 @@
+#pragma once
+
+#include "blurengine.h"
+
+namespace KWin
+{
+
+/**
+ * Scales the background down once, generates mipmaps and samples a blurry mipmap level with a few smoothing taps.
+ * Much cheaper than the other algorithms, but the result is blocky, especially when the background moves.
+ */
+class MipmapBlurEngine : public BlurEngine
+{
+public:
+    MipmapBlurEngine();
+
+    bool isValid() const override;
+    void setStrength(int strength) override;
+    int expandSize() const override;
+    std::vector<BlurRenderTarget> renderTargets(const QSize &backgroundSize) const override;
+    int blurPassCount() const override;
+    void blur(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int vertexCount, const QRect &boundingRect, const QSize &backgroundSize, const QMatrix4x4 &colorMatrix) override;
+    void draw(BlurRenderData &renderInfo, GLVertexBuffer *vbo, int first, int count, const BlurDrawParameters &parameters) override;
+
+    /**
+     * @param sigma The approximate standard deviation of the blur in logical pixels.
+     */
+    void setSigma(float sigma);
+
+private:
+    struct
+    {
+        std::unique_ptr<GLShader> shader;
+        int mvpMatrixLocation;
+        int transformColorsLocation;
+        int colorMatrixLocation;
+    } m_downsamplePass;
+
+    struct
+    {
+        std::unique_ptr<GLShader> shader;
+        int mvpMatrixLocation;
+        int textureLocation;
+        int biasLocation;
+        int halfpixelLocation;
+
+        int noiseLocation;
+        int noiseTextureLocation;
+        int noiseTextureSizeLocation;
+
+        int topCornerRadiusLocation;
+        int bottomCornerRadiusLocation;
+        int antialiasingLocation;
+        int blurSizeLocation;
+        int blurRectLocation;
+        int opacityLocation;
+    } m_upsamplePass;
+
+    bool m_valid = false;
+
+    // The mipmap level of the downsampled background that is sampled, may be fractional.
+    float m_level = 0;
+};
+
+}
@@ -0,0 +1,245 @@
+#include "programbinarycache.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+
+#include <cstring>
+
+Q_DECLARE_LOGGING_CATEGORY(KWIN_BLUR)
+
+namespace KWin
+{
+
+static const quint32 s_magic = 0x4b425043; // KBPC
+static const quint32 s_version = 1;
+
+// Old entries are removed when a new one is written.
+static const int s_maxEntries = 16;
+
+struct ProgramBinaryHeader
+{
+    quint32 magic;
+    quint32 version;
+    quint32 binaryFormat;
+    quint32 length;
+};
+
+ProgramBinaryCache::ProgramBinaryCache()
+    : m_directory(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/kwin-better-blur/programs"))
+{
+    if (epoxy_is_desktop_gl()) {
+        m_supported = epoxy_gl_version() >= 41 || epoxy_has_gl_extension("GL_ARB_get_program_binary");
+    } else {
+        m_supported = epoxy_gl_version() >= 30;
+    }
+    if (m_supported) {
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        m_supported = formatCount > 0;
+    }
+
+    for (const GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        m_driver += reinterpret_cast<const char *>(glGetString(name));
+        m_driver += '\n';
+    }
+}
+
+bool ProgramBinaryCache::isSupported() const
+{
+    return m_supported;
+}
+
+QString ProgramBinaryCache::filePath(const QByteArray &source) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(m_driver);
+    hash.addData(source);
+    return m_directory + QLatin1Char('/') + QString::fromLatin1(hash.result().toHex());
+}
+
+GLuint ProgramBinaryCache::load(const QByteArray &source) const
+{
+    if (!m_supported) {
+        return 0;
+    }
+
+    QFile file(filePath(source));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+
+    const QByteArray data = file.readAll();
+    ProgramBinaryHeader header;
+    if (data.size() < static_cast<qsizetype>(sizeof(header))) {
+        file.remove();
+        return 0;
+    }
+    std::memcpy(&header, data.constData(), sizeof(header));
+    if (header.magic != s_magic
+        || header.version != s_version
+        || data.size() != static_cast<qsizetype>(sizeof(header) + header.length)) {
+        file.remove();
+        return 0;
+    }
+
+    const GLuint program = glCreateProgram();
+    glProgramBinary(program, header.binaryFormat, data.constData() + sizeof(header), header.length);
+
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        glDeleteProgram(program);
+        file.remove();
+        return 0;
+    }
+    return program;
+}
+
+void ProgramBinaryCache::store(const QByteArray &source, GLuint program) const
+{
+    if (!m_supported) {
+        return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    QByteArray binary(length, Qt::Uninitialized);
+    GLenum binaryFormat = 0;
+    glGetProgramBinary(program, length, &length, &binaryFormat, binary.data());
+    binary.truncate(length);
+
+    QThreadPool::globalInstance()->start([directory = m_directory, path = filePath(source), binary, binaryFormat]() {
+        if (!QDir().mkpath(directory)) {
+            return;
+        }
+
+        QDir cacheDirectory(directory);
+        const auto entries = cacheDirectory.entryInfoList(QDir::Files, QDir::Time);
+        for (qsizetype i = s_maxEntries - 1; i < entries.size(); i++) {
+            QFile::remove(entries[i].absoluteFilePath());
+        }
+
+        const ProgramBinaryHeader header{
+            .magic = s_magic,
+            .version = s_version,
+            .binaryFormat = binaryFormat,
+            .length = static_cast<quint32>(binary.size()),
+        };
+
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly)) {
+            return;
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(binary);
+        file.commit();
+    });
+}
+
+/**
+ * Reads the _core variant of the shader file if the context supports GLSL 1.40 or GLSL ES 3.00, and adjusts the
+ * source for OpenGL ES, the same way KWin does for the shaders it loads.
+ */
+static QByteArray readShaderSource(const QString &fileName)
+{
+    const bool gles = !epoxy_is_desktop_gl();
+    const bool core = epoxy_glsl_version() >= (gles ? 300 : 140);
+
+    QString path = fileName;
+    if (core) {
+        path.insert(path.lastIndexOf(QLatin1Char('.')), QStringLiteral("_core"));
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCWarning(KWIN_BLUR) << "Failed to read" << path;
+        return {};
+    }
+
+    QByteArray source = file.readAll();
+    if (gles && core) {
+        source.replace("#version 140", "#version 300 es\n\nprecision highp float;\n");
+    } else if (gles) {
+        source.prepend("precision highp float;\n");
+    }
+    return source;
+}
+
+static GLuint compileShader(GLenum type, const QByteArray &source, const QString &fileName)
+{
+    const GLuint shader = glCreateShader(type);
+    const char *sourceData = source.constData();
+    glShaderSource(shader, 1, &sourceData, nullptr);
+    glCompileShader(shader);
+
+    GLint status = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        GLint logLength = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+        QByteArray log(logLength, '\0');
+        glGetShaderInfoLog(shader, logLength, nullptr, log.data());
+        qCWarning(KWIN_BLUR) << "Failed to compile" << fileName << log;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+GLuint ProgramBinaryCache::buildProgram(const QString &vertexFile, const QString &fragmentFile) const
+{
+    const QByteArray vertexSource = readShaderSource(vertexFile);
+    const QByteArray fragmentSource = readShaderSource(fragmentFile);
+    if (vertexSource.isEmpty() || fragmentSource.isEmpty()) {
+        return 0;
+    }
+
+    const QByteArray source = vertexSource + '\0' + fragmentSource;
+    if (const GLuint program = load(source)) {
+        return program;
+    }
+
+    const GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource, vertexFile);
+    if (!vertexShader) {
+        return 0;
+    }
+    const GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource, fragmentFile);
+    if (!fragmentShader) {
+        glDeleteShader(vertexShader);
+        return 0;
+    }
+
+    const GLuint program = glCreateProgram();
+    if (m_supported) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glBindAttribLocation(program, VA_Position, "position");
+    glBindAttribLocation(program, VA_TexCoord, "texcoord");
+    glLinkProgram(program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint status = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        qCWarning(KWIN_BLUR) << "Failed to link" << vertexFile << fragmentFile;
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    store(source, program);
+    return program;
+}
+
+}
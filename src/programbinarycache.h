@@ -0,0 +1,59 @@
+#pragma once
+
+#include "opengl/glutils.h"
+
+#include <QByteArray>
+#include <QString>
+
+namespace KWin
+{
+
+/**
+ * Stores linked shader program binaries on disk, so that programs don't have to be compiled again after the effect or
+ * the compositor is restarted.
+ *
+ * Programs created by ShaderManager can't be loaded from a binary, so the cached programs are built with GL directly,
+ * either by the owner or with buildProgram().
+ *
+ * Entries are keyed by the sources of the program and the vendor, renderer and version strings of the driver. Binaries
+ * rejected by the driver, for example after it was updated without the version string changing, are removed.
+ */
+class ProgramBinaryCache
+{
+public:
+    ProgramBinaryCache();
+
+    /**
+     * @return Whether the current context can retrieve and load program binaries. Nothing is cached otherwise.
+     */
+    bool isSupported() const;
+
+    /**
+     * @param source All sources of the program, including anything else that affects the result.
+     * @return The linked program, or 0 if there is no valid entry.
+     */
+    GLuint load(const QByteArray &source) const;
+
+    /**
+     * Writes the binary of the program to the cache. GL_PROGRAM_BINARY_RETRIEVABLE_HINT should be set before the
+     * program is linked.
+     */
+    void store(const QByteArray &source, GLuint program) const;
+
+    /**
+     * Loads the program from the cache, or compiles it and stores it in the cache. The shader files are resolved and
+     * prepared for the context like ShaderManager::generateShaderFromFile() does, and the position and texcoord
+     * attributes are bound to the locations used by GLVertexBuffer.
+     * @return The linked program, or 0 if it failed to compile.
+     */
+    GLuint buildProgram(const QString &vertexFile, const QString &fragmentFile) const;
+
+private:
+    QString filePath(const QByteArray &source) const;
+
+    QString m_directory;
+    QByteArray m_driver;
+    bool m_supported = false;
+};
+
+}
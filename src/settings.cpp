@@ -4,16 +4,52 @@
 namespace KWin
 {
 
-void BlurSettings::read()
+// The capture and thumbnail blur modes have the same choices.
+static SecondaryPassMode secondaryPassMode(int value)
+{
+    switch (value) {
+    case BlurConfig::EnumCaptureBlurMode::Static:
+        return SecondaryPassMode::Static;
+    case BlurConfig::EnumCaptureBlurMode::Full:
+        return SecondaryPassMode::Full;
+    default:
+        return SecondaryPassMode::Reuse;
+    }
+}
+
+BlurSettingsChanges BlurSettings::read()
 {
     BlurConfig::self()->read();
 
+    const GeneralSettings oldGeneral = general;
+    const ForceBlurSettings oldForceBlur = forceBlur;
+    const RoundedCornersSettings oldRoundedCorners = roundedCorners;
+    const StaticBlurSettings oldStaticBlur = staticBlur;
+
     general.blurStrength = BlurConfig::blurStrength() - 1;
     general.noiseStrength = BlurConfig::noiseStrength();
     general.windowOpacityAffectsBlur = BlurConfig::transparentBlur();
     general.brightness = BlurConfig::brightness();
     general.saturation = BlurConfig::saturation();
     general.contrast = BlurConfig::contrast();
+    switch (BlurConfig::blurAlgorithm()) {
+    case BlurConfig::EnumBlurAlgorithm::Gaussian:
+        general.algorithm = BlurAlgorithm::Gaussian;
+        break;
+    case BlurConfig::EnumBlurAlgorithm::Mipmap:
+        general.algorithm = BlurAlgorithm::Mipmap;
+        break;
+    default:
+        general.algorithm = BlurAlgorithm::Kawase;
+        break;
+    }
+    general.kernel = BlurConfig::fetchOptimizedKernel() ? KawaseKernel::FetchOptimized : KawaseKernel::Standard;
+    general.computeShaders = BlurConfig::computeShaders();
+    general.maxUpdateRate = BlurConfig::maxBlurUpdateRate();
+    general.memoryBudget = qint64(BlurConfig::memoryBudget()) * 1024 * 1024;
+    general.pauseOnFullScreen = BlurConfig::pauseOnFullScreen();
+    general.captureBlurMode = secondaryPassMode(BlurConfig::captureBlurMode());
+    general.thumbnailBlurMode = secondaryPassMode(BlurConfig::thumbnailBlurMode());
 
     forceBlur.windowClasses = BlurConfig::windowClasses().split("\n");
     forceBlur.windowClassMatchingMode = BlurConfig::blurMatching() ? WindowClassMatchingMode::Whitelist : WindowClassMatchingMode::Blacklist;
@@ -31,13 +67,70 @@ void BlurSettings::read()
 
     staticBlur.enable = BlurConfig::fakeBlur();
     staticBlur.disableWhenWindowBehind = BlurConfig::fakeBlurDisableWhenWindowBehind();
-    staticBlur.customImage = QImage(BlurConfig::fakeBlurImage());
+    staticBlur.customImagePath = BlurConfig::fakeBlurImage();
     if (BlurConfig::fakeBlurImageSourceDesktopWallpaper()) {
         staticBlur.imageSource = StaticBlurImageSource::DesktopWallpaper;
     } else {
         staticBlur.imageSource = StaticBlurImageSource::Custom;
     }
     staticBlur.blurCustomImage = BlurConfig::fakeBlurCustomImageBlur();
+    staticBlur.diskCache = BlurConfig::fakeBlurDiskCache();
+    staticBlur.textureScale = BlurConfig::fakeBlurTextureScale();
+    staticBlur.compactTextureFormat = BlurConfig::fakeBlurCompactTextureFormat();
+
+    if (!m_read) {
+        m_read = true;
+        return BlurSettingsChange::All;
+    }
+
+    BlurSettingsChanges changes;
+    if (general.algorithm != oldGeneral.algorithm || general.kernel != oldGeneral.kernel || general.computeShaders != oldGeneral.computeShaders) {
+        changes |= BlurSettingsChange::Engine;
+    }
+    if (general.blurStrength != oldGeneral.blurStrength) {
+        changes |= BlurSettingsChange::Strength;
+    }
+    if (general.brightness != oldGeneral.brightness || general.saturation != oldGeneral.saturation || general.contrast != oldGeneral.contrast) {
+        changes |= BlurSettingsChange::ColorMatrix;
+    }
+    if (general.noiseStrength != oldGeneral.noiseStrength) {
+        changes |= BlurSettingsChange::Noise;
+    }
+    if (general.windowOpacityAffectsBlur != oldGeneral.windowOpacityAffectsBlur
+        || general.maxUpdateRate != oldGeneral.maxUpdateRate
+        || general.memoryBudget != oldGeneral.memoryBudget
+        || general.pauseOnFullScreen != oldGeneral.pauseOnFullScreen
+        || general.captureBlurMode != oldGeneral.captureBlurMode
+        || general.thumbnailBlurMode != oldGeneral.thumbnailBlurMode
+        || forceBlur.markWindowAsTranslucent != oldForceBlur.markWindowAsTranslucent) {
+        changes |= BlurSettingsChange::Other;
+    }
+    if (forceBlur.windowClasses != oldForceBlur.windowClasses
+        || forceBlur.windowClassMatchingMode != oldForceBlur.windowClassMatchingMode
+        || forceBlur.blurDecorations != oldForceBlur.blurDecorations
+        || forceBlur.blurMenus != oldForceBlur.blurMenus
+        || forceBlur.blurDocks != oldForceBlur.blurDocks) {
+        changes |= BlurSettingsChange::ForceBlur;
+    }
+    if (roundedCorners.windowTopRadius != oldRoundedCorners.windowTopRadius
+        || roundedCorners.windowBottomRadius != oldRoundedCorners.windowBottomRadius
+        || roundedCorners.menuRadius != oldRoundedCorners.menuRadius
+        || roundedCorners.dockRadius != oldRoundedCorners.dockRadius
+        || roundedCorners.antialiasing != oldRoundedCorners.antialiasing
+        || roundedCorners.roundMaximized != oldRoundedCorners.roundMaximized) {
+        changes |= BlurSettingsChange::RoundedCorners;
+    }
+    if (staticBlur.enable != oldStaticBlur.enable
+        || staticBlur.disableWhenWindowBehind != oldStaticBlur.disableWhenWindowBehind
+        || staticBlur.imageSource != oldStaticBlur.imageSource
+        || staticBlur.customImagePath != oldStaticBlur.customImagePath
+        || staticBlur.blurCustomImage != oldStaticBlur.blurCustomImage
+        || staticBlur.diskCache != oldStaticBlur.diskCache
+        || staticBlur.textureScale != oldStaticBlur.textureScale
+        || staticBlur.compactTextureFormat != oldStaticBlur.compactTextureFormat) {
+        changes |= BlurSettingsChange::StaticBlur;
+    }
+    return changes;
 }
 
 }
\ No newline at end of file
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <QImage>
+#include <QFlags>
 #include <QStringList>
 
 namespace KWin
@@ -12,12 +12,59 @@ enum class StaticBlurImageSource
     DesktopWallpaper
 };
 
+enum class BlurAlgorithm
+{
+    Kawase,
+    Gaussian,
+    Mipmap
+};
+
+enum class KawaseKernel
+{
+    Standard,
+    FetchOptimized
+};
+
 enum class WindowClassMatchingMode
 {
     Blacklist,
     Whitelist
 };
 
+/**
+ * How windows are blurred when they're rendered somewhere else than on the screen.
+ */
+enum class SecondaryPassMode
+{
+    /// Draw the result of blurring the window on the screen, blur normally if there is none.
+    Reuse,
+    /// Draw the static blur texture of the screen, blur normally if there is none.
+    Static,
+    /// Blur normally.
+    Full
+};
+
+/**
+ * Groups of settings that invalidate the same state when changed.
+ */
+enum class BlurSettingsChange
+{
+    /// The algorithm and how it's run. The engine has to be recreated.
+    Engine = 1 << 0,
+    Strength = 1 << 1,
+    /// Brightness, saturation and contrast.
+    ColorMatrix = 1 << 2,
+    Noise = 1 << 3,
+    /// Which windows are force blurred.
+    ForceBlur = 1 << 4,
+    RoundedCorners = 1 << 5,
+    StaticBlur = 1 << 6,
+    /// Settings that only affect how the next frames are painted.
+    Other = 1 << 7,
+    All = 0xff
+};
+Q_DECLARE_FLAGS(BlurSettingsChanges, BlurSettingsChange)
+Q_DECLARE_OPERATORS_FOR_FLAGS(BlurSettingsChanges)
 
 struct GeneralSettings
 {
@@ -27,6 +74,24 @@ struct GeneralSettings
     float brightness;
     float saturation;
     float contrast;
+    BlurAlgorithm algorithm;
+    KawaseKernel kernel;
+    bool computeShaders;
+
+    /// How many times per second the blur of a window may be updated, 0 if unlimited.
+    int maxUpdateRate;
+
+    /// The amount of GPU memory the render targets may use before idle ones are freed, in bytes. 0 if unlimited.
+    qint64 memoryBudget;
+
+    /// Whether to stop blurring on screens covered by an opaque full screen window and free their textures.
+    bool pauseOnFullScreen;
+
+    /// Screenshots and screencasts of windows.
+    SecondaryPassMode captureBlurMode;
+
+    /// Thumbnails and other views that render windows into a texture while the screen is painted.
+    SecondaryPassMode thumbnailBlurMode;
 };
 
 struct ForceBlurSettings
@@ -54,8 +119,11 @@ struct StaticBlurSettings
     bool enable;
     bool disableWhenWindowBehind;
     StaticBlurImageSource imageSource;
-    QImage customImage;
+    QString customImagePath;
     bool blurCustomImage;
+    bool diskCache;
+    float textureScale;
+    bool compactTextureFormat;
 };
 
 class BlurSettings
@@ -66,7 +134,13 @@ public:
     RoundedCornersSettings roundedCorners{};
     StaticBlurSettings staticBlur{};
 
-    void read();
+    /**
+     * @return The settings that changed since the last call, all of them the first time.
+     */
+    BlurSettingsChanges read();
+
+private:
+    bool m_read = false;
 };
 
 }
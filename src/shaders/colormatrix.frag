@@ -0,0 +1,9 @@
+uniform sampler2D texUnit;
+uniform mat4 colorMatrix;
+
+varying vec2 uv;
+
+void main(void)
+{
+    gl_FragColor = texture2D(texUnit, uv) * colorMatrix;
+}
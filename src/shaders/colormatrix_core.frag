@@ -0,0 +1,13 @@
+#version 140
+
+uniform sampler2D texUnit;
+uniform mat4 colorMatrix;
+
+in vec2 uv;
+
+out vec4 fragColor;
+
+void main(void)
+{
+    fragColor = texture(texUnit, uv) * colorMatrix;
+}
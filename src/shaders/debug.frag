@@ -0,0 +1,14 @@
+uniform sampler2D texUnit;
+uniform vec4 color;
+uniform bool useTexture;
+
+varying vec2 uv;
+
+void main(void)
+{
+    if (useTexture) {
+        gl_FragColor = texture2D(texUnit, uv) * color;
+    } else {
+        gl_FragColor = color;
+    }
+}
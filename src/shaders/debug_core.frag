@@ -0,0 +1,18 @@
+#version 140
+
+uniform sampler2D texUnit;
+uniform vec4 color;
+uniform bool useTexture;
+
+in vec2 uv;
+
+out vec4 fragColor;
+
+void main(void)
+{
+    if (useTexture) {
+        fragColor = texture(texUnit, uv) * color;
+    } else {
+        fragColor = color;
+    }
+}
@@ -0,0 +1,29 @@
+uniform sampler2D texUnit;
+uniform float offset;
+uniform vec2 halfpixel;
+
+uniform bool transformColors;
+uniform mat4 colorMatrix;
+
+varying vec2 uv;
+
+// The center tap of downsample.frag is split between the four diagonal taps and merged with them using bilinear
+// filtering. The distance of the taps is chosen so that the variance of the kernel stays the same.
+const float tapDistance = 0.70710678;
+
+void main(void)
+{
+    vec2 tapOffset = halfpixel * offset * tapDistance;
+
+    vec4 sum = texture2D(texUnit, uv - tapOffset);
+    sum += texture2D(texUnit, uv + tapOffset);
+    sum += texture2D(texUnit, uv + vec2(tapOffset.x, -tapOffset.y));
+    sum += texture2D(texUnit, uv - vec2(tapOffset.x, -tapOffset.y));
+    sum /= 4.0;
+
+    if (transformColors) {
+        sum *= colorMatrix;
+    }
+
+    gl_FragColor = sum;
+}
@@ -0,0 +1,33 @@
+#version 140
+
+uniform sampler2D texUnit;
+uniform float offset;
+uniform vec2 halfpixel;
+
+uniform bool transformColors;
+uniform mat4 colorMatrix;
+
+in vec2 uv;
+
+out vec4 fragColor;
+
+// The center tap of downsample_core.frag is split between the four diagonal taps and merged with them using bilinear
+// filtering. The distance of the taps is chosen so that the variance of the kernel stays the same.
+const float tapDistance = 0.70710678;
+
+void main(void)
+{
+    vec2 tapOffset = halfpixel * offset * tapDistance;
+
+    vec4 sum = texture(texUnit, uv - tapOffset);
+    sum += texture(texUnit, uv + tapOffset);
+    sum += texture(texUnit, uv + vec2(tapOffset.x, -tapOffset.y));
+    sum += texture(texUnit, uv - vec2(tapOffset.x, -tapOffset.y));
+    sum /= 4.0;
+
+    if (transformColors) {
+        sum *= colorMatrix;
+    }
+
+    fragColor = sum;
+}
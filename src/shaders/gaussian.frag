@@ -0,0 +1,25 @@
+uniform sampler2D texUnit;
+
+// The size of a texel in texture coordinates along the axis that is being blurred.
+uniform vec2 direction;
+
+// Pairs of neighbouring Gaussian weights merged into one bilinear sample, the first one is the center sample.
+uniform float offsets[8];
+uniform float weights[8];
+uniform int sampleCount;
+
+varying vec2 uv;
+
+void main(void)
+{
+    vec4 sum = texture2D(texUnit, uv) * weights[0];
+    for (int i = 1; i < 8; i++) {
+        if (i >= sampleCount) {
+            break;
+        }
+        sum += texture2D(texUnit, uv + direction * offsets[i]) * weights[i];
+        sum += texture2D(texUnit, uv - direction * offsets[i]) * weights[i];
+    }
+
+    gl_FragColor = sum;
+}
@@ -0,0 +1,26 @@
+#version 140
+
+uniform sampler2D texUnit;
+
+// The size of a texel in texture coordinates along the axis that is being blurred.
+uniform vec2 direction;
+
+// Pairs of neighbouring Gaussian weights merged into one bilinear sample, the first one is the center sample.
+uniform float offsets[8];
+uniform float weights[8];
+uniform int sampleCount;
+
+in vec2 uv;
+
+out vec4 fragColor;
+
+void main(void)
+{
+    vec4 sum = texture(texUnit, uv) * weights[0];
+    for (int i = 1; i < sampleCount; i++) {
+        sum += texture(texUnit, uv + direction * offsets[i]) * weights[i];
+        sum += texture(texUnit, uv - direction * offsets[i]) * weights[i];
+    }
+
+    fragColor = sum;
+}
@@ -0,0 +1,18 @@
+uniform sampler2D texUnit;
+
+uniform bool transformColors;
+uniform mat4 colorMatrix;
+
+varying vec2 uv;
+
+void main(void)
+{
+    // A single bilinear sample between four texels averages them when the texture is scaled down by 50%.
+    vec4 color = texture2D(texUnit, uv);
+
+    if (transformColors) {
+        color *= colorMatrix;
+    }
+
+    gl_FragColor = color;
+}
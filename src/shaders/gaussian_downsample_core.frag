@@ -0,0 +1,22 @@
+#version 140
+
+uniform sampler2D texUnit;
+
+uniform bool transformColors;
+uniform mat4 colorMatrix;
+
+in vec2 uv;
+
+out vec4 fragColor;
+
+void main(void)
+{
+    // A single bilinear sample between four texels averages them when the texture is scaled down by 50%.
+    vec4 color = texture(texUnit, uv);
+
+    if (transformColors) {
+        color *= colorMatrix;
+    }
+
+    fragColor = color;
+}
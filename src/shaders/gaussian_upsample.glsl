@@ -0,0 +1,20 @@
+#include "roundedcorners.glsl"
+
+uniform sampler2D texUnit;
+
+uniform bool noise;
+uniform sampler2D noiseTexture;
+uniform vec2 noiseTextureSize;
+
+varying vec2 uv;
+
+void main(void)
+{
+    vec4 sum = texture2D(texUnit, uv);
+
+    if (noise) {
+        sum += vec4(texture2D(noiseTexture, vec2(uv.x, 1.0 - uv.y) * blurSize / noiseTextureSize).rrr, 0.0);
+    }
+
+    gl_FragColor = roundedRectangle(uv * blurSize, sum.rgb);
+}
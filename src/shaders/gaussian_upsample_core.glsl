@@ -0,0 +1,24 @@
+#version 140
+
+#include "roundedcorners.glsl"
+
+uniform sampler2D texUnit;
+
+uniform bool noise;
+uniform sampler2D noiseTexture;
+uniform vec2 noiseTextureSize;
+
+in vec2 uv;
+
+out vec4 fragColor;
+
+void main(void)
+{
+    vec4 sum = texture(texUnit, uv);
+
+    if (noise) {
+        sum += vec4(texture(noiseTexture, vec2(uv.x, 1.0 - uv.y) * blurSize / noiseTextureSize).rrr, 0.0);
+    }
+
+    fragColor = roundedRectangle(uv * blurSize, sum.rgb);
+}
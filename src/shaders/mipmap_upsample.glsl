@@ -0,0 +1,30 @@
+#include "roundedcorners.glsl"
+
+uniform sampler2D texUnit;
+
+// Added to the level of detail chosen by the GPU, so that a blurry mipmap level is sampled.
+uniform float bias;
+// Half of a texel of the sampled mipmap level, in texture coordinates.
+uniform vec2 halfpixel;
+
+uniform bool noise;
+uniform sampler2D noiseTexture;
+uniform vec2 noiseTextureSize;
+
+varying vec2 uv;
+
+void main(void)
+{
+    // Four samples around the pixel hide the blocks of the mipmap level.
+    vec4 sum = texture2D(texUnit, uv + halfpixel, bias);
+    sum += texture2D(texUnit, uv - halfpixel, bias);
+    sum += texture2D(texUnit, uv + vec2(halfpixel.x, -halfpixel.y), bias);
+    sum += texture2D(texUnit, uv - vec2(halfpixel.x, -halfpixel.y), bias);
+    sum /= 4.0;
+
+    if (noise) {
+        sum += vec4(texture2D(noiseTexture, vec2(uv.x, 1.0 - uv.y) * blurSize / noiseTextureSize).rrr, 0.0);
+    }
+
+    gl_FragColor = roundedRectangle(uv * blurSize, sum.rgb);
+}
@@ -0,0 +1,34 @@
+#version 140
+
+#include "roundedcorners.glsl"
+
+uniform sampler2D texUnit;
+
+// Added to the level of detail chosen by the GPU, so that a blurry mipmap level is sampled.
+uniform float bias;
+// Half of a texel of the sampled mipmap level, in texture coordinates.
+uniform vec2 halfpixel;
+
+uniform bool noise;
+uniform sampler2D noiseTexture;
+uniform vec2 noiseTextureSize;
+
+in vec2 uv;
+
+out vec4 fragColor;
+
+void main(void)
+{
+    // Four samples around the pixel hide the blocks of the mipmap level.
+    vec4 sum = texture(texUnit, uv + halfpixel, bias);
+    sum += texture(texUnit, uv - halfpixel, bias);
+    sum += texture(texUnit, uv + vec2(halfpixel.x, -halfpixel.y), bias);
+    sum += texture(texUnit, uv - vec2(halfpixel.x, -halfpixel.y), bias);
+    sum /= 4.0;
+
+    if (noise) {
+        sum += vec4(texture(noiseTexture, vec2(uv.x, 1.0 - uv.y) * blurSize / noiseTextureSize).rrr, 0.0);
+    }
+
+    fragColor = roundedRectangle(uv * blurSize, sum.rgb);
+}
@@ -3,6 +3,9 @@ uniform float bottomCornerRadius;
 uniform float antialiasing;
 
 uniform vec2 blurSize;
+// The area of the window in the background, with the origin at the bottom left corner. Empty if the background only
+// contains this window.
+uniform vec4 blurRect;
 uniform float opacity;
 
 vec4 roundedRectangle(vec2 fragCoord, vec3 texture)
@@ -11,15 +14,21 @@ vec4 roundedRectangle(vec2 fragCoord, vec3 texture)
         return vec4(texture, opacity);
     }
 
-    vec2 halfblurSize = blurSize * 0.5;
+    vec2 size = blurSize;
+    if (blurRect.z > 0.0) {
+        fragCoord -= blurRect.xy;
+        size = blurRect.zw;
+    }
+
+    vec2 halfblurSize = size * 0.5;
     vec2 p = fragCoord - halfblurSize;
     float radius = 0.0;
     if ((fragCoord.y <= bottomCornerRadius)
-        && (fragCoord.x <= bottomCornerRadius || fragCoord.x >= blurSize.x - bottomCornerRadius)) {
+        && (fragCoord.x <= bottomCornerRadius || fragCoord.x >= size.x - bottomCornerRadius)) {
         radius = bottomCornerRadius;
         p.y -= radius;
-    } else if ((fragCoord.y >= blurSize.y - topCornerRadius)
-        && (fragCoord.x <= topCornerRadius || fragCoord.x >= blurSize.x - topCornerRadius)) {
+    } else if ((fragCoord.y >= size.y - topCornerRadius)
+        && (fragCoord.x <= topCornerRadius || fragCoord.x >= size.x - topCornerRadius)) {
         radius = topCornerRadius;
         p.y += radius;
     }
@@ -0,0 +1,38 @@
+#version 140
+
+#include "roundedcorners.glsl"
+
+uniform sampler2D texUnit;
+uniform float offset;
+uniform vec2 halfpixel;
+
+uniform bool noise;
+uniform sampler2D noiseTexture;
+uniform vec2 noiseTextureSize;
+
+in vec2 uv;
+
+out vec4 fragColor;
+
+// Each axis tap of upsample_core.glsl is merged with the neighbouring diagonal tap (weight 1 and 2) using bilinear
+// filtering, which places the merged tap at 1/3 and 2/3 of the distance between them. The taps are then moved out
+// by sqrt(1.2) so that the variance of the kernel stays the same.
+const vec2 tap1 = vec2(-1.46059349, 0.73029674);
+const vec2 tap2 = vec2(0.73029674, 1.46059349);
+
+void main(void)
+{
+    vec2 scale = halfpixel * offset;
+
+    vec4 sum = texture(texUnit, uv + tap1 * scale);
+    sum += texture(texUnit, uv + tap2 * scale);
+    sum += texture(texUnit, uv - tap1 * scale);
+    sum += texture(texUnit, uv - tap2 * scale);
+    sum /= 4.0;
+
+    if (noise) {
+        sum += vec4(texture(noiseTexture, vec2(uv.x, 1.0 - uv.y) * blurSize / noiseTextureSize).rrr, 0.0);
+    }
+
+    fragColor = roundedRectangle(uv * blurSize, sum.rgb);
+}
@@ -0,0 +1,117 @@
+#include "staticblurcache.h"
+
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+
+#include <cstring>
+
+namespace KWin
+{
+
+static const quint32 s_magic = 0x4b424243; // KBBC
+static const quint32 s_version = 1;
+
+// Old entries are removed when a new one is written.
+static const int s_maxEntries = 8;
+
+struct CacheEntryHeader
+{
+    quint32 magic;
+    quint32 version;
+    qint32 width;
+    qint32 height;
+    qint32 bytesPerLine;
+    qint32 format;
+};
+
+StaticBlurCache::StaticBlurCache()
+    : m_directory(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + QStringLiteral("/kwin-better-blur/static"))
+{
+}
+
+QString StaticBlurCache::filePath(const QByteArray &key) const
+{
+    return m_directory + QLatin1Char('/') + QString::fromLatin1(key.toHex());
+}
+
+QImage StaticBlurCache::load(const QByteArray &key) const
+{
+    auto file = new QFile(filePath(key));
+    if (!file->open(QIODevice::ReadOnly) || file->size() < static_cast<qint64>(sizeof(CacheEntryHeader))) {
+        delete file;
+        return {};
+    }
+
+    uchar *data = file->map(0, file->size());
+    if (!data) {
+        delete file;
+        return {};
+    }
+
+    CacheEntryHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    const bool validFormat = header.format > QImage::Format_Invalid && header.format < QImage::NImageFormats;
+
+    // A corrupt stride would make the image read past the end of its lines or of the file.
+    const qint64 minBytesPerLine = validFormat && header.width > 0
+        ? (static_cast<qint64>(header.width) * QImage::toPixelFormat(static_cast<QImage::Format>(header.format)).bitsPerPixel() + 7) / 8
+        : 0;
+    if (header.magic != s_magic
+        || header.version != s_version
+        || header.width <= 0
+        || header.height <= 0
+        || !validFormat
+        || minBytesPerLine <= 0
+        || header.bytesPerLine < minBytesPerLine
+        || file->size() != static_cast<qint64>(sizeof(header)) + static_cast<qint64>(header.bytesPerLine) * header.height) {
+        file->remove();
+        delete file;
+        return {};
+    }
+
+    // The file is unmapped and closed once the last copy of the image is destroyed.
+    return QImage(static_cast<const uchar *>(data + sizeof(header)), header.width, header.height, header.bytesPerLine, static_cast<QImage::Format>(header.format), [](void *file) {
+        delete static_cast<QFile *>(file);
+    }, file);
+}
+
+void StaticBlurCache::store(const QByteArray &key, const QImage &image) const
+{
+    if (image.isNull()) {
+        return;
+    }
+
+    QThreadPool::globalInstance()->start([directory = m_directory, path = filePath(key), image]() {
+        if (!QDir().mkpath(directory)) {
+            return;
+        }
+
+        QDir cacheDirectory(directory);
+        const auto entries = cacheDirectory.entryInfoList(QDir::Files, QDir::Time);
+        for (qsizetype i = s_maxEntries - 1; i < entries.size(); i++) {
+            QFile::remove(entries[i].absoluteFilePath());
+        }
+
+        const CacheEntryHeader header{
+            .magic = s_magic,
+            .version = s_version,
+            .width = image.width(),
+            .height = image.height(),
+            .bytesPerLine = static_cast<qint32>(image.bytesPerLine()),
+            .format = image.format(),
+        };
+
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly)) {
+            return;
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(image.constBits()), image.sizeInBytes());
+        file.commit();
+    });
+}
+
+}
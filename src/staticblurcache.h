@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+
+namespace KWin
+{
+
+/**
+ * Stores blurred static images on disk, so that they don't have to be created again after the effect is reloaded.
+ *
+ * Entries contain raw pixels in the same row order as the texture they were read from and are memory-mapped when
+ * loaded.
+ */
+class StaticBlurCache
+{
+public:
+    StaticBlurCache();
+
+    /**
+     * @return The cached image, or a null image if there is no valid entry for the specified key. The image
+     * references the mapped file and must not outlive the upload.
+     */
+    QImage load(const QByteArray &key) const;
+
+    /**
+     * Writes the image to the cache asynchronously.
+     */
+    void store(const QByteArray &key, const QImage &image) const;
+
+private:
+    QString filePath(const QByteArray &key) const;
+
+    QString m_directory;
+};
+
+}
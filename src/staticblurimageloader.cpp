@@ -0,0 +1,156 @@
+#include "staticblurimageloader.h"
+
+#include <QDataStream>
+#include <QFileInfo>
+
+namespace KWin
+{
+
+StaticBlurImageLoader::StaticBlurImageLoader()
+{
+}
+
+StaticBlurImageLoader::~StaticBlurImageLoader()
+{
+    // Tasks deliver their results to this object.
+    m_threadPool.clear();
+    m_threadPool.waitForDone();
+}
+
+void StaticBlurImageLoader::setPath(const QString &path)
+{
+    QByteArray key;
+    if (const QFileInfo imageInfo(path); !path.isEmpty() && imageInfo.exists()) {
+        QDataStream stream(&key, QIODevice::WriteOnly);
+        stream << imageInfo.absoluteFilePath()
+               << imageInfo.lastModified().toMSecsSinceEpoch()
+               << imageInfo.size();
+    }
+
+    if (path == m_path && key == m_key) {
+        return;
+    }
+
+    m_path = path;
+    m_key = key;
+    m_generation++;
+    m_image = QImage();
+    m_decoding = false;
+    m_failed = false;
+    m_pendingSizes.clear();
+    m_scaledImages.clear();
+}
+
+QByteArray StaticBlurImageLoader::key() const
+{
+    return m_key;
+}
+
+void StaticBlurImageLoader::setBlurParameters(const std::optional<CpuBlurParameters> &parameters)
+{
+    if (parameters == m_blurParameters) {
+        return;
+    }
+
+    m_blurParameters = parameters;
+    m_scaleGeneration++;
+    m_scaledImages.clear();
+
+    // Images that are being scaled right now will be discarded, scale them again. The decoded image is kept until
+    // all of them are done.
+    if (!m_image.isNull()) {
+        for (const QSize &size : std::as_const(m_pendingSizes)) {
+            scale(size);
+        }
+    }
+}
+
+bool StaticBlurImageLoader::blursImages() const
+{
+    return m_blurParameters.has_value();
+}
+
+QImage StaticBlurImageLoader::image(const QSize &size)
+{
+    if (m_key.isEmpty() || m_failed || size.isEmpty()) {
+        return {};
+    }
+
+    for (const auto &[scaledSize, scaledImage] : m_scaledImages) {
+        if (scaledSize == size) {
+            return scaledImage;
+        }
+    }
+
+    if (m_pendingSizes.contains(size)) {
+        return {};
+    }
+    m_pendingSizes.append(size);
+
+    if (!m_image.isNull()) {
+        scale(size);
+    } else if (!m_decoding) {
+        decode();
+    }
+    return {};
+}
+
+void StaticBlurImageLoader::releaseScaledImages()
+{
+    m_scaledImages.clear();
+}
+
+void StaticBlurImageLoader::decode()
+{
+    m_decoding = true;
+    m_threadPool.start([this, path = m_path, generation = m_generation]() {
+        const QImage image(path);
+        QMetaObject::invokeMethod(this, [this, image, generation]() {
+            if (generation != m_generation) {
+                return;
+            }
+
+            m_decoding = false;
+            if (image.isNull()) {
+                m_failed = true;
+                m_pendingSizes.clear();
+                return;
+            }
+
+            m_image = image;
+            for (const QSize &size : std::as_const(m_pendingSizes)) {
+                scale(size);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void StaticBlurImageLoader::scale(const QSize &size)
+{
+    m_threadPool.start([this, image = m_image, size, blurParameters = m_blurParameters, generation = m_generation, scaleGeneration = m_scaleGeneration]() {
+        QImage scaledImage = image.scaled(size, Qt::AspectRatioMode::IgnoreAspectRatio, Qt::TransformationMode::SmoothTransformation);
+        if (blurParameters) {
+            scaledImage = cpuBlur(scaledImage, *blurParameters);
+        }
+
+        QMetaObject::invokeMethod(this, [this, scaledImage, size, generation, scaleGeneration]() {
+            if (generation != m_generation || scaleGeneration != m_scaleGeneration) {
+                return;
+            }
+
+            m_pendingSizes.removeOne(size);
+            m_scaledImages.append({size, scaledImage});
+
+            // The decoded image is usually much larger than the scaled ones and is only needed again if an output
+            // with a new size is added or the blur parameters change, in which case it's decoded again.
+            if (m_pendingSizes.isEmpty()) {
+                m_image = QImage();
+            }
+            Q_EMIT imageReady();
+        }, Qt::QueuedConnection);
+    });
+}
+
+}
+
+#include "moc_staticblurimageloader.cpp"
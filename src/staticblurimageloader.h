@@ -0,0 +1,91 @@
+#pragma once
+
+#include "cpublur.h"
+
+#include <QImage>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+
+#include <optional>
+
+namespace KWin
+{
+
+/**
+ * Decodes the custom static blur image, scales it for every output and optionally blurs it on worker threads, so that
+ * none of this happens on the compositor thread.
+ */
+class StaticBlurImageLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    StaticBlurImageLoader();
+    ~StaticBlurImageLoader() override;
+
+    /**
+     * Sets the image to load. Nothing is done if neither the path nor the modification time of the file changed.
+     * @param path Can be empty, in which case all images are released.
+     */
+    void setPath(const QString &path);
+
+    /**
+     * @return Data identifying the current version of the image, or an empty array if the file doesn't exist.
+     */
+    QByteArray key() const;
+
+    /**
+     * Sets the parameters of the blur applied to the scaled images. Already scaled images are discarded if the
+     * parameters changed.
+     * @param parameters Can be std::nullopt, in which case the images aren't blurred.
+     */
+    void setBlurParameters(const std::optional<CpuBlurParameters> &parameters);
+
+    /**
+     * @return Whether the images are blurred by the loader.
+     */
+    bool blursImages() const;
+
+    /**
+     * @return The image scaled to the specified size and blurred if blur parameters are set, or a null image if it's not ready yet. In that case the image is
+     * decoded and scaled in the background and imageReady is emitted when done. Requests made while the image is
+     * being decoded are scaled in parallel.
+     */
+    QImage image(const QSize &size);
+
+    /**
+     * Releases all scaled images. The decoded image is released as soon as no more images are being scaled, so it's
+     * decoded again when an image is requested afterwards.
+     */
+    void releaseScaledImages();
+
+Q_SIGNALS:
+    void imageReady();
+
+private:
+    void decode();
+    void scale(const QSize &size);
+
+    QThreadPool m_threadPool;
+
+    QString m_path;
+    QByteArray m_key;
+    // Incremented when the image changes, results of tasks started for older images are discarded.
+    quint64 m_generation = 0;
+    // Incremented when the blur parameters change, results of scaling tasks started before are discarded.
+    quint64 m_scaleGeneration = 0;
+
+    std::optional<CpuBlurParameters> m_blurParameters;
+
+    // Only kept while images are being scaled.
+    QImage m_image;
+    bool m_decoding = false;
+    bool m_failed = false;
+
+    QList<QSize> m_pendingSizes;
+    QList<std::pair<QSize, QImage>> m_scaledImages;
+};
+
+}
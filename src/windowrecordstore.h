@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace KWin
+{
+
+class EffectWindow;
+
+/**
+ * Stores a record for every window in one contiguous array. Slots of removed windows are reused, so looking up,
+ * adding and removing a record takes constant time, and walking all records doesn't follow any pointers.
+ *
+ * Every slot has a generation that is incremented when its record is removed. A handle is only valid as long as the
+ * generation it was created with matches, which makes it safe to capture handles in signal connections that may
+ * outlive the window.
+ */
+template<typename T>
+class WindowRecordStore
+{
+public:
+    struct Handle
+    {
+        uint32_t index = 0;
+        uint32_t generation = 0;
+    };
+
+    /**
+     * @return The record of the window, created if it doesn't exist.
+     */
+    T &insert(EffectWindow *w)
+    {
+        if (auto it = m_indices.find(w); it != m_indices.end()) {
+            return *m_slots[it->second].record;
+        }
+
+        uint32_t index;
+        if (!m_freeSlots.empty()) {
+            index = m_freeSlots.back();
+            m_freeSlots.pop_back();
+        } else {
+            index = m_slots.size();
+            m_slots.emplace_back();
+        }
+
+        Slot &slot = m_slots[index];
+        slot.window = w;
+        slot.record.emplace();
+        m_indices[w] = index;
+        return *slot.record;
+    }
+
+    void remove(const EffectWindow *w)
+    {
+        auto it = m_indices.find(w);
+        if (it == m_indices.end()) {
+            return;
+        }
+
+        Slot &slot = m_slots[it->second];
+        slot.window = nullptr;
+        slot.record.reset();
+        slot.generation++;
+        m_freeSlots.push_back(it->second);
+        m_indices.erase(it);
+    }
+
+    /**
+     * @return The record of the window, or nullptr if it doesn't exist.
+     */
+    T *find(const EffectWindow *w)
+    {
+        if (auto it = m_indices.find(w); it != m_indices.end()) {
+            return &*m_slots[it->second].record;
+        }
+        return nullptr;
+    }
+
+    const T *find(const EffectWindow *w) const
+    {
+        if (auto it = m_indices.find(w); it != m_indices.end()) {
+            return &*m_slots[it->second].record;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @return A handle to the record of the window. Invalid if the window doesn't have a record.
+     */
+    Handle handle(const EffectWindow *w) const
+    {
+        if (auto it = m_indices.find(w); it != m_indices.end()) {
+            return Handle{it->second, m_slots[it->second].generation};
+        }
+        return Handle{UINT32_MAX, 0};
+    }
+
+    /**
+     * @return The window the handle was created for, or nullptr if its record was removed.
+     */
+    EffectWindow *window(Handle handle) const
+    {
+        if (handle.index >= m_slots.size() || m_slots[handle.index].generation != handle.generation) {
+            return nullptr;
+        }
+        return m_slots[handle.index].window;
+    }
+
+    /**
+     * Calls the function with the window and the record of every window, in no particular order.
+     */
+    template<typename F>
+    void forEach(F function)
+    {
+        for (Slot &slot : m_slots) {
+            if (slot.window) {
+                function(slot.window, *slot.record);
+            }
+        }
+    }
+
+    template<typename F>
+    void forEach(F function) const
+    {
+        for (const Slot &slot : m_slots) {
+            if (slot.window) {
+                function(slot.window, *slot.record);
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        return m_indices.size();
+    }
+
+private:
+    struct Slot
+    {
+        /// nullptr if the slot is free.
+        EffectWindow *window = nullptr;
+        uint32_t generation = 0;
+        std::optional<T> record;
+    };
+
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+    std::unordered_map<const EffectWindow *, uint32_t> m_indices;
+};
+
+}